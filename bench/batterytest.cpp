@@ -0,0 +1,109 @@
+/**
+ * Host tests for the battery filter: step response, settling time and the
+ * full scale path through Battery::sample() with BATTERY_OVERSAMPLING
+ * readings. The ADC is modelled as linear up to 3100 mV at the pin. Prints
+ * one line per check and exits with 1 if any failed.
+ */
+#include "battery.h"
+
+HardwareSerial Serial;
+
+#define ADC_FULL_SCALE_MV 3100
+
+static uint16_t adcRaw;
+static int failures;
+
+void pinMode(uint8_t, uint8_t) {}
+
+uint16_t analogRead(uint8_t) {
+  return adcRaw;
+}
+
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t, adc_atten_t, adc_bits_width_t, uint32_t,
+  esp_adc_cal_characteristics_t*) {
+  return ESP_ADC_CAL_VAL_DEFAULT_VREF;
+}
+
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t raw, const esp_adc_cal_characteristics_t*) {
+  return raw * ADC_FULL_SCALE_MV / 4095;
+}
+
+static void check(const char* name, bool ok, long value) {
+  printf("%s %s (%ld)\n", ok ? "ok  " : "FAIL", name, value);
+  failures += !ok;
+}
+
+// the reading a battery voltage ends up as after divider and ADC
+static uint16_t measured(uint16_t batteryMv) {
+  adcRaw = (uint32_t) batteryMv * 1000 / BATTERY_DIVIDER_RATIO_MILLI * 4095 / ADC_FULL_SCALE_MV;
+  return esp_adc_cal_raw_to_voltage(adcRaw, NULL) * BATTERY_DIVIDER_RATIO_MILLI / 1000;
+}
+
+static void stepResponse() {
+  BatteryFilter filter(BATTERY_FILTER_SHIFT);
+  uint16_t value = filter.update(3700);
+  check("first sample primes the filter", value == 3700, value);
+
+  // a one pole filter covers 1 - (1 - 2^-shift)^n of a step after n samples
+  uint32_t n = 1 << BATTERY_FILTER_SHIFT;
+  for (uint32_t i = 0; i < n; i++) {
+    value = filter.update(4200);
+  }
+  long percent = (value - 3700) * 100L / 500;
+  check("step up covers 60-68 % after one time constant", percent >= 60 && percent <= 68, percent);
+
+  for (uint32_t i = 0; i < 40 * n; i++) {
+    value = filter.update(4200);
+  }
+  check("step up settles exactly", value == 4200, value);
+
+  for (uint32_t i = 0; i < 40 * n; i++) {
+    value = filter.update(3700);
+  }
+  check("step down settles exactly", value == 3700, value);
+}
+
+static void settlingTime() {
+  BatteryFilter filter(BATTERY_FILTER_SHIFT);
+  filter.update(3700);
+  uint32_t samples = 0;
+  while (filter.update(4200) < 4200 - 5 && samples < 1000) {
+    samples++;
+  }
+  // within 1 % of the step after about 4.6 time constants
+  long ms = (long) (samples + 1) * BATTERY_SAMPLE_MS;
+  check("step settles to 5 mV within 10 s", ms <= 10000, ms);
+}
+
+static void fullScale() {
+  BatteryFilter filter(BATTERY_FILTER_SHIFT);
+  filter.update(0);
+  uint16_t value = 0;
+  for (int i = 0; i < 2000; i++) {
+    value = filter.update(65535);
+  }
+  check("largest input does not overflow", value == 65535, value);
+
+  Battery battery(0);
+  uint16_t expected = measured(4200);
+  battery.init();
+  for (int i = 0; i < 100; i++) {
+    battery.sample();
+  }
+  check("4.2 V with oversampling reads back", battery.millivolts() == expected, battery.millivolts());
+  check("4.2 V is at least 99 %", battery.percent() >= 99, battery.percent());
+
+  adcRaw = 4095;
+  expected = ADC_FULL_SCALE_MV * BATTERY_DIVIDER_RATIO_MILLI / 1000;
+  for (int i = 0; i < 1000; i++) {
+    battery.sample();
+  }
+  check("ADC full scale with oversampling reads back", battery.millivolts() == expected, battery.millivolts());
+}
+
+int main() {
+  stepResponse();
+  settlingTime();
+  fullScale();
+  return failures ? 1 : 0;
+}
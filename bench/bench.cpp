@@ -0,0 +1,212 @@
+/**
+ * Host micro benchmarks for the pure logic parts of the firmware. Every
+ * benchmark is repeated and the fastest run is reported, results are written
+ * as JSON to stdout so revisions can be compared with compare.py.
+ */
+#include <chrono>
+#include <string>
+#include <vector>
+#include "ringbuffer.h"
+#include "mapper.h"
+#include "tags.h"
+#include "SPIFFS.h"
+#include "arena.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+SDFS SD;
+SPIFFSFS SPIFFS;
+
+#define REPETITIONS 5
+
+typedef std::chrono::steady_clock Clock;
+
+static std::vector<std::string> results;
+static volatile uint32_t sink;
+
+static void result(const std::string& name, double value, const char* unit) {
+  char buf[160];
+  snprintf(buf, sizeof(buf), "{\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}", name.c_str(), value, unit);
+  results.push_back(buf);
+}
+
+// fastest of REPETITIONS runs in ns
+template<typename F> static double fastest(F run) {
+  double best = 0;
+  for (int i = 0; i < REPETITIONS; i++) {
+    Clock::time_point start = Clock::now();
+    run();
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    if (i == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+/**
+ * Byte wise put/get in 1 KB blocks, the way the player used to fill and
+ * drain the buffer, and the bulk interface with 4 KB SD reads and 32 byte
+ * decoder chunks.
+ */
+static void benchRingBuffer() {
+  const uint32_t total = 32 * 1024 * 1024;
+  RingBuffer ringBuffer;
+  ringBuffer.allocate(20000);
+  static uint8_t source[4096];
+
+  double ns = fastest([&]() {
+    uint32_t sum = 0;
+    for (uint32_t done = 0; done < total; done += 1024) {
+      for (uint16_t i = 0; i < 1024; i++) {
+        ringBuffer.put((uint8_t) i);
+      }
+      for (uint16_t i = 0; i < 1024; i++) {
+        sum += ringBuffer.get();
+      }
+    }
+    sink = sum;
+  });
+  result("ringbuffer_put_get", ns / total, "ns/byte");
+
+  ns = fastest([&]() {
+    uint32_t sum = 0;
+    for (uint32_t done = 0; done < total; ) {
+      uint32_t len;
+      uint8_t* ptr = ringBuffer.writePtr(len);
+      if (len > sizeof(source)) {
+        len = sizeof(source);
+      }
+      memcpy(ptr, source, len);
+      ringBuffer.commitWrite(len);
+      while (ringBuffer.avail()) {
+        ptr = ringBuffer.readPtr(len);
+        if (len > 32) {
+          len = 32;
+        }
+        sum += ptr[0];
+        ringBuffer.commitRead(len);
+        done += len;
+      }
+    }
+    sink = sum;
+  });
+  result("ringbuffer_bulk", ns / total, "ns/byte");
+}
+
+static bool readId(const char* line, byte id[ID_BYTE_ARRAY_LENGTH]) {
+  unsigned int value;
+  if (sscanf(line, "%8x", &value) != 1) {
+    return false;
+  }
+  for (uint8_t i = 0; i < ID_BYTE_ARRAY_LENGTH; i++) {
+    id[i] = value >> (24 - 8 * i);
+  }
+  return true;
+}
+
+/**
+ * Validation of the whole mapping file, without and with an up to date
+ * validation cache, and lookups of the first, middle and last card as well
+ * as an unknown one, which has to scan the whole file.
+ */
+static void benchMapper(const char* fixture) {
+  std::string root = std::string("fixtures/") + fixture;
+  SD.setRoot(root.c_str());
+
+  std::vector<std::string> lines;
+  FILE* f = fopen((root + MAPPING_FILE).c_str(), "r");
+  char line[128];
+  while (f && fgets(line, sizeof(line), f)) {
+    lines.push_back(line);
+  }
+  if (f) {
+    fclose(f);
+  }
+  if (lines.empty()) {
+    fprintf(stderr, "Fixture %s missing, run fixtures.py\n", fixture);
+    exit(1);
+  }
+
+  Mapper mapper;
+  Mapper::MapperError err = mapper.init();
+  double ns = fastest([&]() {
+    SPIFFS.remove(MAPPING_CACHE_FILE);
+    err = mapper.check();
+  });
+  if (err != Mapper::OK) {
+    fprintf(stderr, "Fixture %s: mapping check failed with %d\n", fixture, err);
+  }
+  result(std::string("mapper_check_") + fixture, ns / 1e6, "ms");
+
+  ns = fastest([&]() {
+    err = mapper.check();
+  });
+  result(std::string("mapper_check_cached_") + fixture, ns / 1e6, "ms");
+
+  struct Lookup {
+    const char* name;
+    size_t line;
+  } lookups[] = {
+    {"first", 0},
+    {"middle", lines.size() / 2},
+    {"last", lines.size() - 1},
+  };
+
+  for (Lookup& lookup : lookups) {
+    byte id[ID_BYTE_ARRAY_LENGTH];
+    readId(lines[lookup.line].c_str(), id);
+    char filename[MAX_FILENAME_STRING_LENGTH];
+    ns = fastest([&]() {
+      err = mapper.resolveIdToFilename(id, filename);
+    });
+    result(std::string("mapper_resolve_") + fixture + "_" + lookup.name, ns / 1e3, "us");
+  }
+
+  byte unknown[ID_BYTE_ARRAY_LENGTH] = {0xFF, 0xFF, 0xFF, 0xFE};
+  char filename[MAX_FILENAME_STRING_LENGTH];
+  ns = fastest([&]() {
+    err = mapper.resolveIdToFilename(unknown, filename);
+  });
+  result(std::string("mapper_resolve_") + fixture + "_missing", ns / 1e3, "us");
+}
+
+/**
+ * The ID3v2 header check done for every track, on a mix of tagged and
+ * untagged headers.
+ */
+static void benchTags() {
+  const uint32_t calls = 10 * 1000 * 1000;
+  uint8_t headers[4][ID3V2_HEADER_LENGTH] = {
+    {'I', 'D', '3', 3, 0, 0, 0, 0, 0x10, 0x7F},
+    {'I', 'D', '3', 4, 0, 0x10, 0, 0x01, 0x7F, 0x00},
+    {0xFF, 0xFB, 0x90, 0x64, 0, 0, 0, 0, 0, 0},
+    {'I', 'D', '3', 3, 0, 0, 0x7F, 0x7F, 0x7F, 0x7F},
+  };
+
+  double ns = fastest([&]() {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+      sum += id3v2TagLength(headers[i & 3]);
+    }
+    sink = sum;
+  });
+  result("id3v2_tag_length", ns / calls, "ns/call");
+}
+
+int main(int argc, char** argv) {
+  arena.begin();
+  SPIFFS.setRoot("fixtures/spiffs");
+  benchRingBuffer();
+  benchMapper("example");
+  benchMapper("1k");
+  benchMapper("10k");
+  benchTags();
+
+  printf("{\n  \"revision\": \"%s\",\n  \"benchmarks\": [\n", argc > 1 ? argv[1] : "unknown");
+  for (size_t i = 0; i < results.size(); i++) {
+    printf("    %s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+  }
+  printf("  ]\n}\n");
+  return 0;
+}
@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+"""
+Compare two benchmark results written by run.sh. All values are times, lower
+is better.
+
+Usage: compare.py old.json new.json
+"""
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data["revision"], {b["name"]: b for b in data["benchmarks"]}
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip())
+        sys.exit(1)
+    old_rev, old = load(sys.argv[1])
+    new_rev, new = load(sys.argv[2])
+    print("%-36s %14s %14s %8s" % ("benchmark", old_rev[:14], new_rev[:14], "change"))
+    for name, b in new.items():
+        if name not in old:
+            print("%-36s %14s %14.3f %8s  %s" % (name, "-", b["value"], "new", b["unit"]))
+            continue
+        before = old[name]["value"]
+        change = (b["value"] - before) / before * 100 if before else 0
+        print("%-36s %14.3f %14.3f %+7.1f%%  %s" % (name, before, b["value"], change, b["unit"]))
+
+
+if __name__ == "__main__":
+    main()
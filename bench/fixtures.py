@@ -0,0 +1,39 @@
+#!/usr/bin/env python3
+"""
+Generate the mapping file fixtures for the benchmarks: the example mapping
+from sd-card/ and synthetic mappings with 1k and 10k cards. Each fixture is a
+directory standing in for the SD card root, "spiffs" stands in for the SPIFFS
+partition.
+"""
+import os
+import random
+import shutil
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+FIXTURES = os.path.join(HERE, "fixtures")
+
+
+def synthetic(name, cards, seed):
+    rng = random.Random(seed)
+    ids = set()
+    while len(ids) < cards:
+        ids.add(rng.getrandbits(32))
+    root = os.path.join(FIXTURES, name)
+    os.makedirs(root, exist_ok=True)
+    with open(os.path.join(root, "mapping.txt"), "w") as f:
+        for i, card in enumerate(sorted(ids, key=lambda _: rng.random())):
+            f.write("%08X /cards/%05d/track.mp3\n" % (card, i))
+
+
+def main():
+    root = os.path.join(FIXTURES, "example")
+    os.makedirs(root, exist_ok=True)
+    shutil.copy(os.path.join(HERE, "..", "sd-card", "mapping.txt"), root)
+    synthetic("1k", 1000, 1)
+    synthetic("10k", 10000, 10)
+    # stands in for the SPIFFS partition
+    os.makedirs(os.path.join(FIXTURES, "spiffs"), exist_ok=True)
+
+
+if __name__ == "__main__":
+    main()
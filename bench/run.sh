@@ -0,0 +1,10 @@
+#!/bin/sh
+# Build and run the host benchmarks, the JSON result is written to stdout.
+# Usage: bench/run.sh > result.json
+set -e
+cd "$(dirname "$0")"
+python3 fixtures.py
+${CXX:-c++} -std=gnu++11 -O2 -Wall -DLOG_LEVEL=0 -Istubs -I../src -o bench \
+  bench.cpp ../src/ringbuffer.cpp ../src/mapper.cpp ../src/tags.cpp ../src/trace.cpp \
+  ../src/arena.cpp
+./bench "$(git describe --always --dirty 2>/dev/null || echo unknown)"
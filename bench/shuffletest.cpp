@@ -0,0 +1,47 @@
+/**
+ * Host tests for the shuffled play order: for several counts, including the
+ * powers of 4 where the network grows by two bits, and several seeds, at()
+ * has to be a permutation of 0..count-1 and indexOf() its inverse. Prints
+ * one line per count and exits with 1 if any failed.
+ */
+#include "shuffle.h"
+#include <vector>
+
+HardwareSerial Serial;
+
+static int failures;
+
+static void check(uint16_t count, const uint32_t* seeds, uint8_t seedCount) {
+  uint32_t outside = 0;
+  uint32_t repeated = 0;
+  uint32_t inverse = 0;
+  for (uint8_t s = 0; s < seedCount; s++) {
+    Shuffle shuffle;
+    shuffle.begin(count, seeds[s]);
+    std::vector<bool> seen(count, false);
+    for (uint32_t position = 0; position < count; position++) {
+      uint16_t index = shuffle.at(position);
+      if (index >= count) {
+        outside++;
+        continue;
+      }
+      repeated += seen[index];
+      seen[index] = true;
+      inverse += shuffle.indexOf(index) != position;
+    }
+  }
+  bool ok = outside == 0 && repeated == 0 && inverse == 0;
+  printf("%s count %u: %u outside, %u repeated, %u not restored\n", ok ? "ok  " : "FAIL", count, outside,
+    repeated, inverse);
+  failures += !ok;
+}
+
+int main() {
+  static const uint32_t seeds[] = {0, 1, 0x12345678, 0xDEADBEEF, 0xFFFFFFFF};
+  static const uint16_t counts[] = {1, 2, 3, 4, 5, 15, 16, 17, 63, 64, 65, 255, 256, 257, 1000, 1023, 1024, 1025,
+    4096, 16384, 65535};
+  for (uint8_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    check(counts[i], seeds, sizeof(seeds) / sizeof(seeds[0]));
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+/**
+ * Host harness for network streams: HttpSource, JitterBuffer and RingBuffer
+ * as the player uses them, a POSIX socket Client and a decoder model, which
+ * consumes the buffer at the bit rate of the stream. Each argument is a
+ * scenario "name=url", run against bench/streamserver.py by stream.sh.
+ * Results are written as JSON like run.sh does, so compare.py works on them.
+ */
+#include <string>
+#include <vector>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "ringbuffer.h"
+#include "httpsource.h"
+#include "jitter.h"
+#include "arena.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static std::vector<std::string> results;
+
+static void result(const std::string& name, double value, const char* unit) {
+  char buf[160];
+  snprintf(buf, sizeof(buf), "{\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}", name.c_str(), value, unit);
+  results.push_back(buf);
+}
+
+/**
+ * Blocking connect like WiFiClient, reads never block.
+ */
+class HostClient : public Client {
+  private:
+    int fd;
+
+  public:
+    HostClient() : fd(-1) {}
+
+    int connect(const char* host, uint16_t port) {
+      stop();
+      char service[8];
+      snprintf(service, sizeof(service), "%u", port);
+      struct addrinfo hints = {}, *info;
+      hints.ai_socktype = SOCK_STREAM;
+      if (getaddrinfo(host, service, &hints, &info) != 0) {
+        return 0;
+      }
+      fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+      if (fd >= 0 && ::connect(fd, info->ai_addr, info->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+      }
+      freeaddrinfo(info);
+      return fd >= 0;
+    }
+
+    size_t write(const uint8_t* buf, size_t size) {
+      return fd >= 0 ? send(fd, buf, size, MSG_NOSIGNAL) : 0;
+    }
+
+    int available() {
+      int n = 0;
+      if (fd < 0 || ioctl(fd, FIONREAD, &n) != 0) {
+        return 0;
+      }
+      return n;
+    }
+
+    int read() {
+      uint8_t c;
+      return read(&c, 1) == 1 ? c : -1;
+    }
+
+    int read(uint8_t* buf, size_t size) {
+      return fd >= 0 ? recv(fd, buf, size, MSG_DONTWAIT) : -1;
+    }
+
+    void stop() {
+      if (fd >= 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+
+    // closed once the peer shut down and everything was read
+    uint8_t connected() {
+      if (fd < 0) {
+        return 0;
+      }
+      struct pollfd p = {fd, POLLIN, 0};
+      if (poll(&p, 1, 0) <= 0) {
+        return 1;
+      }
+      uint8_t c;
+      return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 0;
+    }
+};
+
+/**
+ * Play one stream: fill the buffer from the source, feed the decoder model
+ * in 32 byte chunks at the bit rate while the jitter buffer allows it. The
+ * server sends bytes 0x80 | (offset % 128), so leaked metadata and bytes
+ * out of place are found. A live stream may jump on a reconnect, a file has
+ * to continue where it broke off.
+ */
+static void run(const char* name, const char* url, RingBuffer &ringBuffer, uint32_t kbps, uint32_t timeoutMs) {
+  HostClient client;
+  HttpSource stream(client);
+  JitterBuffer jitter;
+
+  ringBuffer.empty();
+  uint32_t start = millis();
+  if (!stream.open(url)) {
+    fprintf(stderr, "%s: cannot open %s\n", name, url);
+    exit(1);
+  }
+  jitter.begin(start, ringBuffer.capacity());
+
+  uint32_t bytesPerSecond = kbps * 125;
+  uint64_t consumed = 0;
+  uint64_t due = 0;
+  uint32_t starvedMs = 0;
+  uint32_t misplaced = 0;
+  uint32_t foreign = 0;
+  uint32_t reconnects = 0;
+  int previous = -1;
+  uint32_t last = millis();
+
+  while (millis() - start < timeoutMs) {
+    uint32_t len;
+    uint8_t* ptr = ringBuffer.writePtr(len);
+    if (len > SD_READ_CHUNK) {
+      len = SD_READ_CHUNK;
+    }
+    uint32_t read = len > 0 ? stream.read(ptr, len) : 0;
+    if (stream.reconnects != reconnects) {
+      previous = -1;
+      reconnects = stream.reconnects;
+    }
+    for (uint32_t i = 0; i < read; i++) {
+      if (ptr[i] < 0x80) {
+        foreign++;
+      } else if (stream.total > 0) {
+        misplaced += ptr[i] != (0x80 | ((stream.position - read + i) & 0x7F));
+      } else if (previous >= 0) {
+        misplaced += ptr[i] != (0x80 | ((previous + 1) & 0x7F));
+      }
+      previous = ptr[i];
+    }
+    ringBuffer.commitWrite(read);
+    bool done = stream.done();
+
+    // the decoder model pauses while the jitter buffer holds it back
+    uint32_t now = millis();
+    bool feeding = jitter.update(ringBuffer.avail(), done, now);
+    if (feeding) {
+      due += (uint64_t) (now - last) * bytesPerSecond / 1000;
+    } else {
+      due = consumed;
+      if (consumed > 0) {
+        starvedMs += now - last;
+      }
+    }
+    last = now;
+
+    while (feeding && consumed < due && ringBuffer.avail()) {
+      uint32_t chunk;
+      ringBuffer.readPtr(chunk);
+      if (chunk > 32) {
+        chunk = 32;
+      }
+      ringBuffer.commitRead(chunk);
+      consumed += chunk;
+    }
+
+    if (done && ringBuffer.avail() == 0) {
+      break;
+    }
+    usleep(1000);
+  }
+
+  std::string n(name);
+  result("stream_" + n + "_first_data", stream.firstDataMillis, "ms");
+  result("stream_" + n + "_startup", jitter.startupMillis, "ms");
+  result("stream_" + n + "_underruns", jitter.underruns, "count");
+  result("stream_" + n + "_starved", starvedMs, "ms");
+  result("stream_" + n + "_reconnects", stream.reconnects, "count");
+  result("stream_" + n + "_corrupt", misplaced + foreign, "bytes");
+  fprintf(stderr, "%s: %llu bytes played, %s, title '%s', target %u\n", name, (unsigned long long) consumed,
+    stream.failed() ? "failed" : "ok", stream.title(), jitter.target);
+  stream.close();
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: stream revision name=url [name=url ...]\n");
+    return 1;
+  }
+  uint32_t kbps = getenv("KBPS") ? atoi(getenv("KBPS")) : 128;
+  uint32_t timeoutMs = getenv("TIMEOUT_MS") ? atoi(getenv("TIMEOUT_MS")) : 60000;
+
+  arena.begin();
+  RingBuffer ringBuffer;
+  ringBuffer.allocate(RINGBUFFER_SIZE);
+
+  for (int i = 2; i < argc; i++) {
+    std::string arg(argv[i]);
+    size_t eq = arg.find('=');
+    run(arg.substr(0, eq).c_str(), arg.substr(eq + 1).c_str(), ringBuffer, kbps, timeoutMs);
+  }
+
+  printf("{\n  \"revision\": \"%s\",\n  \"benchmarks\": [\n", argv[1]);
+  for (size_t i = 0; i < results.size(); i++) {
+    printf("    %s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+  }
+  printf("  ]\n}\n");
+  return 0;
+}
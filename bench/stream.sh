@@ -0,0 +1,21 @@
+#!/bin/sh
+# Build the stream harness and run it against a local streamserver.py, the JSON
+# result is written to stdout. Usage: bench/stream.sh > result.json
+set -e
+cd "$(dirname "$0")"
+PORT=${PORT:-8765}
+${CXX:-c++} -std=gnu++11 -O2 -Wall -DLOG_LEVEL=0 -Istubs -I../src -o stream \
+  stream.cpp ../src/httpsource.cpp ../src/jitter.cpp ../src/ringbuffer.cpp ../src/arena.cpp
+python3 streamserver.py --port "$PORT" &
+SERVER=$!
+trap 'kill $SERVER' EXIT
+sleep 1
+URL="http://127.0.0.1:$PORT"
+./stream "$(git describe --always --dirty 2>/dev/null || echo unknown)" \
+  "steady=$URL/file?seconds=8" \
+  "jitter=$URL/file?seconds=8&jitter=40" \
+  "stalls=$URL/file?seconds=8&stall=1500&every=3" \
+  "resume=$URL/file?seconds=8&drop=40000" \
+  "nolength=$URL/file?seconds=4&nolength=1" \
+  "icy=$URL/live?seconds=10&metaint=8192&drop=60000&burst=16000" \
+  "redirect=$URL/moved?seconds=4"
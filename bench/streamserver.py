@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""
+Local HTTP server for bench/stream.cpp. Audio is replaced by bytes
+0x80 | (offset % 128), sent at the bit rate with injected network trouble.
+
+  /file   a file of the given length, with Content-Length and range requests
+  /live   an endless Icecast style stream, which starts at the live position
+          on every connection and interleaves ICY metadata if asked for
+  /moved  redirects to the file
+
+Query parameters:
+  seconds=8      length of the file, resp. time after the first request to
+                 /live, after which it answers 410 Gone
+  kbps=128       bit rate
+  burst=0        bytes sent at once on connect, like Icecast does
+  jitter=0       random delay of up to this many ms before every 1 KB
+  stall=0        pause of this many ms ...
+  every=0        ... every that many seconds of audio
+  drop=0         close the connection after this many bytes
+  metaint=0      ICY metadata interval of /live (only if the client asks)
+  nolength=0     /file without Content-Length and range requests, the end
+                 is the closed connection
+
+usage: streamserver.py [--port 8080]
+"""
+import argparse
+import random
+import time
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+CHUNK = 1024
+live_started = None
+
+
+def payload(offset, length):
+    return bytes(0x80 | ((offset + i) & 0x7F) for i in range(length))
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.0"
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_GET(self):
+        url = urllib.parse.urlparse(self.path)
+        query = {k: float(v[0]) for k, v in urllib.parse.parse_qs(url.query).items()}
+        self.options = query
+        rate = query.get("kbps", 128) * 125
+        seconds = query.get("seconds", 8)
+        if url.path == "/file":
+            self.send_file(int(rate * seconds))
+        elif url.path == "/live":
+            self.send_live(rate, seconds)
+        elif url.path == "/moved":
+            self.send_response(302)
+            self.send_header("Location", "http://%s/file?%s" % (self.headers["Host"], url.query))
+            self.end_headers()
+        else:
+            self.send_error(404)
+
+    def send_file(self, size):
+        start = 0
+        header = self.headers.get("Range", "")
+        nolength = self.options.get("nolength", 0)
+        if header.startswith("bytes=") and not nolength:
+            start = int(header[6:].split("-")[0])
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, size - 1, size))
+        else:
+            self.send_response(200)
+        self.send_header("Content-Type", "audio/mpeg")
+        if not nolength:
+            self.send_header("Content-Length", str(size - start))
+            self.send_header("Accept-Ranges", "bytes")
+        self.end_headers()
+        self.pace(start, size, 0)
+
+    def send_live(self, rate, seconds):
+        global live_started
+        if live_started is None:
+            live_started = time.time()
+        elapsed = time.time() - live_started
+        if elapsed > seconds:
+            self.send_error(410)
+            return
+        metaint = int(self.options.get("metaint", 0)) if self.headers.get("Icy-MetaData") == "1" else 0
+        self.send_response(200)
+        self.send_header("Content-Type", "audio/mpeg")
+        self.send_header("icy-name", "bench")
+        if metaint:
+            self.send_header("icy-metaint", str(metaint))
+        self.end_headers()
+        live = int(elapsed * rate)
+        self.pace(live, int(seconds * rate), metaint)
+
+    def pace(self, offset, end, metaint):
+        """Send from offset to end at the bit rate, with the injected trouble."""
+        o = self.options
+        rate = o.get("kbps", 128) * 125
+        burst = int(o.get("burst", 0))
+        drop = int(o.get("drop", 0))
+        stall_every = o.get("every", 0) * rate
+        sent = 0
+        until_meta = metaint
+        began = time.time() - burst / rate
+        try:
+            while offset < end:
+                if drop and sent >= drop:
+                    return
+                if o.get("jitter"):
+                    time.sleep(random.uniform(0, o["jitter"]) / 1000)
+                if stall_every and offset // stall_every != (offset + CHUNK) // stall_every:
+                    time.sleep(o.get("stall", 0) / 1000)
+                    began += o.get("stall", 0) / 1000
+                length = min(CHUNK, end - offset)
+                if drop:
+                    length = min(length, drop - sent)
+                data = payload(offset, length)
+                if metaint:
+                    out = b""
+                    while data:
+                        part, data = data[:until_meta], data[until_meta:]
+                        out += part
+                        until_meta -= len(part)
+                        if until_meta == 0:
+                            out += self.metadata(offset)
+                            until_meta = metaint
+                    data = out
+                self.wfile.write(data)
+                offset += length
+                sent += length
+                wait = began + sent / rate - time.time()
+                if wait > 0:
+                    time.sleep(wait)
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+
+    @staticmethod
+    def metadata(offset):
+        text = ("StreamTitle='Track %d';" % (offset // 50000)).encode()
+        blocks = (len(text) + 15) // 16
+        return bytes([blocks]) + text.ljust(blocks * 16, b"\0")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split("\n")[0])
+    parser.add_argument("--port", type=int, default=8080)
+    args = parser.parse_args()
+    ThreadingHTTPServer(("127.0.0.1", args.port), Handler).serve_forever()
+
+
+if __name__ == "__main__":
+    main()
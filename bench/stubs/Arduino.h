@@ -0,0 +1,62 @@
+/**
+ * Minimal host replacement for the Arduino core, only what the benchmarked
+ * modules need. Serial output is discarded so it does not distort timings.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+typedef uint8_t byte;
+
+#define F(s) (s)
+#define IRAM_ATTR
+
+inline uint32_t micros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) (ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+inline uint32_t millis() {
+  return micros() / 1000;
+}
+
+inline bool psramFound() {
+  return false;
+}
+
+inline void* ps_malloc(size_t size) {
+  return malloc(size);
+}
+
+// heap statistics are not meaningful on the host
+class EspClass {
+  public:
+    uint32_t getFreeHeap() { return 0; }
+    uint32_t getMaxAllocHeap() { return 0; }
+};
+
+extern EspClass ESP;
+
+// provided by the tests which need them
+#define ANALOG 0xC0
+void pinMode(uint8_t pin, uint8_t mode);
+uint16_t analogRead(uint8_t pin);
+
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+inline void portENTER_CRITICAL(portMUX_TYPE*) {}
+inline void portEXIT_CRITICAL(portMUX_TYPE*) {}
+
+class HardwareSerial {
+  public:
+    template<typename T> size_t print(T) { return 0; }
+    template<typename T> size_t println(T) { return 0; }
+    size_t println() { return 0; }
+    size_t printf(const char*, ...) { return 0; }
+};
+
+extern HardwareSerial Serial;
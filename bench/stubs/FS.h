@@ -0,0 +1,56 @@
+/**
+ * Host file system on top of stdio, rooted at a directory so each fixture
+ * can play the role of the SD card.
+ */
+#pragma once
+#include "Arduino.h"
+#include <string>
+#include <memory>
+#include <sys/stat.h>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+
+namespace fs {
+
+class File {
+  public:
+    File(FILE* f = NULL) : f(f, closeFile) {}
+    operator bool() const { return f != NULL; }
+    int read() { return fgetc(f.get()); }
+    size_t read(uint8_t* buf, size_t len) { return fread(buf, 1, len, f.get()); }
+    int available() {
+      long pos = ftell(f.get());
+      fseek(f.get(), 0, SEEK_END);
+      long end = ftell(f.get());
+      fseek(f.get(), pos, SEEK_SET);
+      return (int) (end - pos);
+    }
+    size_t write(const uint8_t* buf, size_t len) { return fwrite(buf, 1, len, f.get()); }
+    bool seek(uint32_t pos) { return fseek(f.get(), pos, SEEK_SET) == 0; }
+    size_t position() { return ftell(f.get()); }
+    size_t size() { struct stat st; return fstat(fileno(f.get()), &st) == 0 ? st.st_size : 0; }
+    time_t getLastWrite() { struct stat st; return fstat(fileno(f.get()), &st) == 0 ? st.st_mtime : 0; }
+    void close() { f.reset(); }
+    bool isDirectory() { return false; }
+
+  private:
+    // closed with the last copy, like the Arduino File
+    std::shared_ptr<FILE> f;
+    static void closeFile(FILE* f) { if (f) fclose(f); }
+};
+
+class FS {
+  public:
+    void setRoot(const char* dir) { root = dir; }
+    File open(const char* path, const char* mode = FILE_READ) { return File(fopen((root + path).c_str(), mode)); }
+    bool exists(const char* path) { File f = open(path); bool ok = f; f.close(); return ok; }
+    bool remove(const char* path) { return ::remove((root + path).c_str()) == 0; }
+
+  private:
+    std::string root;
+};
+
+}
+
+using fs::File;
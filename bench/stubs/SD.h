@@ -0,0 +1,5 @@
+#pragma once
+#include "FS.h"
+
+class SDFS : public fs::FS {};
+extern SDFS SD;
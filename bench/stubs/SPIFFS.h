@@ -0,0 +1,5 @@
+#pragma once
+#include "FS.h"
+
+class SPIFFSFS : public fs::FS {};
+extern SPIFFSFS SPIFFS;
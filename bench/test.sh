@@ -0,0 +1,11 @@
+#!/bin/sh
+# Build and run the host tests, exits non-zero if one fails.
+# Usage: bench/test.sh
+set -e
+cd "$(dirname "$0")"
+${CXX:-c++} -std=gnu++11 -O2 -Wall -DLOG_LEVEL=0 -Istubs -I../src -o batterytest \
+  batterytest.cpp ../src/battery.cpp
+${CXX:-c++} -std=gnu++11 -O2 -Wall -DLOG_LEVEL=0 -Istubs -I../src -o shuffletest \
+  shuffletest.cpp ../src/shuffle.cpp
+./batterytest
+./shuffletest
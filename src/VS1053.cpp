@@ -24,6 +24,8 @@
 #include "VS1053.h"
 #include "tools.h"
 #include "config.h"
+#include "binlog.h"
+#include "spitrace.h"
 
 VS1053::VS1053 (uint8_t _xcsPin, uint8_t _xdcsPin, uint8_t _dreqPin, uint8_t _xresetPin) : 
   xcsPin(_xcsPin), 
@@ -31,8 +33,9 @@ VS1053::VS1053 (uint8_t _xcsPin, uint8_t _xdcsPin, uint8_t _dreqPin, uint8_t _xr
   dreqPin(_dreqPin), 
   xresetPin(_xresetPin) {}
 
-uint16_t VS1053::read_register (uint8_t _reg) const {
+uint16_t VS1053::sci_read (uint8_t _reg) const {
   uint16_t result;
+  SPI_TRACE_BEGIN();
   controlModeOn();
   SPI.write(3);                                // Read operation
   SPI.write(_reg);                             // Register to write (0..0xF)
@@ -41,34 +44,83 @@ uint16_t VS1053::read_register (uint8_t _reg) const {
            (SPI.transfer (0xFF));
   await_data_request();                         // Wait for DREQ to be HIGH again
   controlModeOff();
+  SPI_TRACE_END(SPI_DEVICE_VS1053_SCI, false, 4);
   return result;
 }
 
-void VS1053::write_register (uint8_t _reg, uint16_t _value) const {
+void VS1053::sci_write (uint8_t _reg, uint16_t _value) const {
+  SPI_TRACE_BEGIN();
   controlModeOn();
   SPI.write(2);                                // Write operation
   SPI.write(_reg);                             // Register to write (0..0xF)
   SPI.write16(_value);                         // Send 16 bits data
   await_data_request();
   controlModeOff();
+  SPI_TRACE_END(SPI_DEVICE_VS1053_SCI, true, 4);
+}
+
+/**
+ * Registers which only change when written are served from the shadow copy.
+ */
+uint16_t VS1053::read_register (uint8_t _reg) {
+  if (isCached(_reg)) {
+    return shadow[_reg];
+  }
+  uint16_t value = sci_read(_reg);
+  if (cachedRegisters & (1 << _reg)) {
+    shadow[_reg] = value;
+    shadowValid |= (1 << _reg);
+  }
+  return value;
+}
+
+/**
+ * Writes to cached registers are skipped if the value does not change.
+ */
+void VS1053::write_register (uint8_t _reg, uint16_t _value) {
+  if (isCached(_reg) && shadow[_reg] == _value) {
+    return;
+  }
+  sci_write(_reg, _value);
+  shadow[_reg] = _value;
+  shadowValid |= (1 << _reg);
+}
+
+/**
+ * Register accesses between beginBatch() and endBatch() share one SPI
+ * transaction, XCS is still toggled for every single access.
+ */
+void VS1053::beginBatch() {
+  SPI.beginTransaction ( VS1053_SPI ) ;
+  inBatch = true;
+}
+
+void VS1053::endBatch() {
+  inBatch = false;
+  SPI.endTransaction() ;
 }
 
 void VS1053::sdi_send_buffer (uint8_t* data, size_t len) {
+  SPI_TRACE_BEGIN();
+  size_t total = len;
   dataModeOn();
   while (len) {                                  // More to do?
     await_data_request();                         // Wait for space available
     size_t chunk_length = len;
     if (len > vs1053ChunkSize) {
-      size_t chunk_length = vs1053ChunkSize;
+      chunk_length = vs1053ChunkSize;
     }
     len -= chunk_length;
     SPI.writeBytes (data, chunk_length);
     data += chunk_length;
   }
   dataModeOff();
+  SPI_TRACE_END(SPI_DEVICE_VS1053_SDI, true, total);
 }
 
 void VS1053::sdi_send_fillers (size_t len) {
+  SPI_TRACE_BEGIN();
+  size_t total = len;
   dataModeOn();
   while (len) {                                  // More to do?
     await_data_request();                         // Wait for space available
@@ -82,6 +134,42 @@ void VS1053::sdi_send_fillers (size_t len) {
     }
   }
   dataModeOff();
+  SPI_TRACE_END(SPI_DEVICE_VS1053_SDI, true, total);
+}
+
+/**
+ * SCI multiple write: command and address are sent once, followed by n data
+ * words. DREQ is awaited after every word. Writes to SCI_WRAM auto-increment
+ * SCI_WRAMADDR, so this uploads a whole block of memory in one transaction.
+ */
+void VS1053::sci_write_burst (uint8_t _reg, const uint16_t* data, size_t n) {
+  SPI_TRACE_BEGIN();
+  size_t total = 2 + 2 * n;
+  controlModeOn();
+  SPI.write(2);                                // Write operation
+  SPI.write(_reg);                             // Register to write (0..0xF)
+  while (n--) {
+    SPI.write16(*data++);
+    await_data_request();
+  }
+  controlModeOff();
+  SPI_TRACE_END(SPI_DEVICE_VS1053_SCI, true, total);
+  shadowValid &= ~(1 << _reg);
+}
+
+void VS1053::sci_write_repeat (uint8_t _reg, uint16_t value, size_t n) {
+  SPI_TRACE_BEGIN();
+  size_t total = 2 + 2 * n;
+  controlModeOn();
+  SPI.write(2);                                // Write operation
+  SPI.write(_reg);                             // Register to write (0..0xF)
+  while (n--) {
+    SPI.write16(value);
+    await_data_request();
+  }
+  controlModeOff();
+  SPI_TRACE_END(SPI_DEVICE_VS1053_SCI, true, total);
+  shadowValid &= ~(1 << _reg);
 }
 
 void VS1053::wram_write (uint16_t address, uint16_t data) {
@@ -118,9 +206,9 @@ bool VS1053::testComm (const char *header) {
   }
   Serial.println (header);                                 // Show a header
   for (i = 0; (i < 0xFFFF) && (cnt < 20); i += delta) {
-    write_register (SCI_VOL, i);                     // Write data to SCI_VOL
-    r1 = read_register (SCI_VOL);                    // Read back for the first time
-    r2 = read_register (SCI_VOL);                    // Read back a second time
+    sci_write (SCI_VOL, i);                          // Write data to SCI_VOL
+    r1 = sci_read (SCI_VOL);                         // Read back for the first time
+    r2 = sci_read (SCI_VOL);                         // Read back a second time
     if  (r1 != r2 || i != r1 || i != r2)              // Check for 2 equal reads
     {
       Serial.printf ("VS1053 error retry SB:%04X R1:%04X R2:%04X\n", i, r1, r2);
@@ -129,6 +217,7 @@ bool VS1053::testComm (const char *header) {
     }
     yield();                                           // Allow ESP firmware to do some bookkeeping
   }
+  shadowValid &= ~(1 << SCI_VOL);                      // SCI_VOL was written behind the cache
   return (cnt == 0);                                 // Return the result
 }
 
@@ -164,7 +253,25 @@ void VS1053::begin() {
   delay (100);
     
    softReset();                                         
+   configure();
+  
+  testComm ("Fast SPI, Testing VS1053 read/write registers again...");    
+  delay(200);
   
+  await_data_request();
+  endFillByte = wram_read (0x1E06) & 0xFF;
+
+  Serial.printf ("endFillByte is %X\n", endFillByte);
+  delay (100);
+}
+
+/**
+ * Everything a reset sets back to the defaults, run after begin() and after
+ * a failed cancel. SPI is slow until the clock multiplier is set.
+ */
+void VS1053::configure() {
+  VS1053_SPI = SPISettings (200000, MSBFIRST, SPI_MODE0);
+
   // Power up analog circuits (44.1kHz stereo)
   write_register (SCI_AUDATA, 44100 + 1);
   
@@ -174,15 +281,6 @@ void VS1053::begin() {
   //SPI Clock to 4 MHz
   VS1053_SPI = SPISettings (4000000, MSBFIRST, SPI_MODE0);
   write_register (SCI_MODE, _BV (SM_SDINEW) | _BV (SM_LINE1));
-  
-  testComm ("Fast SPI, Testing VS1053 read/write registers again...");    
-  delay(200);
-  
-  await_data_request();
-  endFillByte = wram_read (0x1E06) & 0xFF;
-
-  Serial.printf ("endFillByte is %X\n", endFillByte);
-  delay (100);
 }
 
 void VS1053::setVolume (uint8_t vol) {
@@ -191,15 +289,15 @@ void VS1053::setVolume (uint8_t vol) {
   // Clicking reduced by using 0xf8 to 0x00 as limits.
   uint16_t value;                                      // Value to send to SCI_VOL
 
+  //value = map (vol, 0, 100, 0xF8, 0x00);           // 0..100% to one channel
+  value = map (vol, 0, 100, 0x8f, 0x10);             // 0..100% to one channel
+  value = (value << 8) | value;
+  write_register (SCI_VOL, value);                   // Volume left and right, skipped if unchanged
+
   if (vol != curvol) {
     curvol = vol;                                      // Save for later use
-    //value = map (vol, 0, 100, 0xF8, 0x00);           // 0..100% to one channel
-    value = map (vol, 0, 100, 0x8f, 0x10);           // 0..100% to one channel
-    value = (value << 8) | value;
-    write_register (SCI_VOL, value);                 // Volume left and right
+    LOG_INFO(LOG_VOLUME, vol);
   }
-
-  Serial.printf ("Volume %d\n", vol);
 }
 
 void VS1053::setTone (uint8_t *rtone) {               // Set bass/treble (4 nibbles)
@@ -225,28 +323,109 @@ void VS1053::playChunk (uint8_t* data, size_t len) {
 }
 
 void VS1053::stopSong() {
-  uint16_t modereg;                     // Read from mode register
-  int      i;                           // Loop control
-
   sdi_send_fillers (2052);
-  delay (10);
-  write_register (SCI_MODE, _BV (SM_SDINEW) | _BV (SM_CANCEL));
-  for (i = 0; i < 200; i++) {
-    sdi_send_fillers (32);
-    modereg = read_register (SCI_MODE);  // Read status
-    if ((modereg & _BV (SM_CANCEL)) == 0) {
-      sdi_send_fillers (2052);
-      Serial.printf("Song stopped correctly after %d ms\n", i * 10);
-      return;
+  beginCancel();
+  while (!processCancel()) {
+    yield();
+  }
+}
+
+/**
+ * Start the cancel sequence (datasheet 10.5.2) without waiting for it to finish.
+ * Any partially filled chunk of the old song is dropped.
+ */
+void VS1053::beginCancel() {
+  chunkbufcnt = 0;
+  cancelFillCount = 0;
+  cancelling = true;
+  resetting = false;
+  write_register (SCI_MODE, _BV (SM_SDINEW) | _BV (SM_LINE1) | _BV (SM_CANCEL));
+}
+
+/**
+ * Feed one chunk of fill bytes and check SM_CANCEL. Only sends when DREQ
+ * is high, so a call never blocks for more than one 32 byte chunk.
+ * Returns true as soon as no cancel is in progress anymore. If the decoder
+ * had to be reset, wasReset() tells so afterwards, the plugins are gone.
+ */
+bool VS1053::processCancel() {
+  if (!cancelling) {
+    return true;
+  }
+  if (resetting) {
+    // DREQ drops during the reset, give it time to do so
+    if (micros() - resetStarted < 2000 || !data_request()) {
+      return false;
+    }
+    configure();
+    // volume and tone are back at the defaults, restore what was set
+    if (restoreValid & (1 << SCI_VOL)) {
+      write_register (SCI_VOL, restoreVol);
     }
-    delay (10);
+    if (restoreValid & (1 << SCI_BASS)) {
+      write_register (SCI_BASS, restoreBass);
+    }
+    resetting = false;
+    cancelling = false;
+    reset = true;
+    return true;
+  }
+  if (!data_request()) {
+    return false;
+  }
+  sdi_send_fillers (vs1053ChunkSize);
+  cancelFillCount += vs1053ChunkSize;
+  if ((read_register (SCI_MODE) & _BV (SM_CANCEL)) == 0) {
+    Serial.printf("Song stopped correctly after %d fill bytes\n", cancelFillCount);
+    cancelling = false;
+    return true;
   }
-  Serial.println("Song stopped incorrectly!");
-  printDetails ();
+  if (cancelFillCount >= 2048) {
+    // decoder did not react, the datasheet recommends a software reset
+    Serial.println("Song stopped incorrectly!");
+    restoreVol = shadow[SCI_VOL];
+    restoreBass = shadow[SCI_BASS];
+    restoreValid = shadowValid;
+    write_register (SCI_MODE, _BV (SM_SDINEW) | _BV (SM_RESET));
+    shadowValid = 0;
+    resetStarted = micros();
+    resetting = true;
+  }
+  return false;
+}
+
+bool VS1053::wasReset() {
+  bool result = reset;
+  reset = false;
+  return result;
+}
+
+void VS1053::resetDecodeTime() {
+  // the datasheet recommends writing it twice
+  write_register (SCI_DECODE_TIME, 0);
+  write_register (SCI_DECODE_TIME, 0);
+}
+
+bool VS1053::isDecoding() {
+  beginBatch();
+  uint16_t hdat0 = read_register (SCI_HDAT0);
+  uint16_t decodeTime = read_register (SCI_DECODE_TIME);
+  endBatch();
+  return (hdat0 != 0) || (decodeTime != 0);
+}
+
+void VS1053::readStatus(uint16_t &decodeTime, uint16_t &hdat0, uint16_t &hdat1, uint16_t &audata) {
+  beginBatch();
+  decodeTime = read_register (SCI_DECODE_TIME);
+  hdat0 = read_register (SCI_HDAT0);
+  hdat1 = read_register (SCI_HDAT1);
+  audata = read_register (SCI_AUDATA);
+  endBatch();
 }
 
 void VS1053::softReset() {
   write_register (SCI_MODE, _BV (SM_SDINEW) | _BV (SM_RESET));
+  shadowValid = 0;                                   // Registers are back at their defaults
   delay (10);
   await_data_request();
 }
@@ -260,11 +439,49 @@ void VS1053::processByte (uint8_t b, bool force) {
   return;    
 }
 
+/**
+ * Upload a plugin in VLSI's compressed format. The image is a sequence of
+ * records: register address, count, data. If bit 15 of count is set the
+ * single data word is repeated (count & 0x7FFF) times, otherwise count
+ * data words follow. False if the image is malformed.
+ */
+bool VS1053::loadPlugin (File &file) {
+  uint16_t buf[32];
+  uint16_t header[2];
+
+  while (file.available()) {
+    if (file.read ((uint8_t*) header, sizeof(header)) != sizeof(header)) {
+      return false;
+    }
+    uint16_t addr = header[0];
+    uint16_t n = header[1];
+    if (addr > SCI_num_registers) {
+      return false;
+    }
+    if (n & 0x8000) {
+      if (file.read ((uint8_t*) buf, 2) != 2) {
+        return false;
+      }
+      sci_write_repeat (addr, buf[0], n & 0x7FFF);
+      continue;
+    }
+    while (n) {
+      uint16_t chunk = n < 32 ? n : 32;
+      if (file.read ((uint8_t*) buf, chunk * 2) != chunk * 2) {
+        return false;
+      }
+      sci_write_burst (addr, buf, chunk);
+      n -= chunk;
+    }
+  }
+  return true;
+}
+
 void VS1053::printDetails () {
   Serial.println("VS1053 register dump:");
   Serial.println("REG   Contents");
   Serial.println("---   --------");
   for (uint8_t i = 0; i <= SCI_num_registers; i++) {
-    Serial.printf("%3x - %5x\n", i, read_register(i));
+    Serial.printf("%3x - %5x\n", i, sci_read(i));
   }
 }
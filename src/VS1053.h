@@ -23,6 +23,7 @@
 #pragma once
 #include <Arduino.h>
 #include <SPI.h>
+#include <FS.h>
 
 class VS1053 {
   private:
@@ -38,9 +39,12 @@ class VS1053 {
     const uint8_t SCI_MODE          = 0x0 ;
     const uint8_t SCI_BASS          = 0x2 ;
     const uint8_t SCI_CLOCKF        = 0x3 ;
+    const uint8_t SCI_DECODE_TIME   = 0x4 ;
     const uint8_t SCI_AUDATA        = 0x5 ;
     const uint8_t SCI_WRAM          = 0x6 ;
     const uint8_t SCI_WRAMADDR      = 0x7 ;
+    const uint8_t SCI_HDAT0         = 0x8 ;
+    const uint8_t SCI_HDAT1         = 0x9 ;
     const uint8_t SCI_AIADDR        = 0xA ;
     const uint8_t SCI_VOL           = 0xB ;
     const uint8_t SCI_AICTRL0       = 0xC ;
@@ -59,6 +63,23 @@ class VS1053 {
 
     __attribute__((aligned(4))) uint8_t chunkbuf[32]; // Chunk buffer
     uint8_t chunkbufcnt = 0;                          // Data in chunk buffer
+
+    // Shadow copy of the SCI registers. Only registers whose contents are not
+    // changed by the chip itself are cached (see cachedRegisters).
+    uint16_t      shadow[16];
+    uint16_t      shadowValid = 0;                    // Bit per register, set if shadow is valid
+    const uint16_t cachedRegisters = (1 << 0x2) | (1 << 0x3) | (1 << 0xA) | (1 << 0xB);  // BASS, CLOCKF, AIADDR, VOL
+    bool          inBatch = false;                    // SPI bus already acquired by beginBatch()
+
+    bool          cancelling = false;                 // Cancel sequence in progress
+    uint16_t      cancelFillCount = 0;                // Fill bytes sent since SM_CANCEL was set
+    bool          resetting = false;                  // Cancel failed, waiting for the soft reset to finish
+    bool          reset = false;                      // Set after such a reset, see wasReset()
+    uint32_t      resetStarted = 0;
+    uint16_t      restoreVol = 0;                     // Volume and tone to write back after the reset
+    uint16_t      restoreBass = 0;
+    uint16_t      restoreValid = 0;
+    void          configure() ;                       // Settings lost on a reset
     
   protected:
     inline void await_data_request() const {
@@ -68,35 +89,52 @@ class VS1053 {
     }
 
     inline void controlModeOn() const {
-      SPI.beginTransaction ( VS1053_SPI ) ;       // Prevent other SPI users
+      if (!inBatch) {
+        SPI.beginTransaction ( VS1053_SPI ) ;     // Prevent other SPI users
+      }
       digitalWrite(xcsPin, LOW);
     }
 
     inline void controlModeOff() const {
       digitalWrite(xcsPin, HIGH);
-      SPI.endTransaction() ;                      // Allow other SPI users
+      if (!inBatch) {
+        SPI.endTransaction() ;                    // Allow other SPI users
+      }
     }
 
     inline void dataModeOn() const {
-      SPI.beginTransaction ( VS1053_SPI ) ;       // Prevent other SPI users
+      if (!inBatch) {
+        SPI.beginTransaction ( VS1053_SPI ) ;     // Prevent other SPI users
+      }
       digitalWrite(xdcsPin, LOW);
     }
 
     inline void dataModeOff() const {
       digitalWrite(xdcsPin, HIGH);
-      SPI.endTransaction() ;                      // Allow other SPI users
+      if (!inBatch) {
+        SPI.endTransaction() ;                    // Allow other SPI users
+      }
+    }
+
+    inline bool isCached ( uint8_t _reg ) const {
+      return (cachedRegisters & shadowValid & (1 << _reg)) != 0;
     }
 
-    uint16_t read_register ( uint8_t _reg ) const ;
-    void     write_register ( uint8_t _reg, uint16_t _value ) const ;
+    uint16_t sci_read ( uint8_t _reg ) const ;                // Uncached register access
+    void     sci_write ( uint8_t _reg, uint16_t _value ) const ;
+    uint16_t read_register ( uint8_t _reg ) ;                 // Register access through the shadow cache
+    void     write_register ( uint8_t _reg, uint16_t _value ) ;
     void     sdi_send_buffer ( uint8_t* data, size_t len ) ;
     void     sdi_send_fillers ( size_t length ) ;
+    void     sci_write_burst ( uint8_t _reg, const uint16_t* data, size_t n ) ;
+    void     sci_write_repeat ( uint8_t _reg, uint16_t value, size_t n ) ;
     void     wram_write ( uint16_t address, uint16_t data ) ;
     uint16_t wram_read ( uint16_t address ) ;
 
   public:
   
     VS1053(uint8_t _xcsPin, uint8_t _xdcsPin, uint8_t _dreqPin, uint8_t _xresetPin);
+    VS1053(const VS1053&) = delete;                      // one instance per chip, pass references
     
     void     begin();                                     // Sets pins correctly and prepares SPI bus.
     void     startSong() ;                               // Prepare to start playing. Call this each time a new song starts.
@@ -104,12 +142,25 @@ class VS1053 {
     // the chip.  Blocks until complete.
     void     stopSong() ;                                // Finish playing a song. Call this after
     // the last playChunk call.
+    void     beginCancel() ;                             // Start cancelling the current song, does not block.
+    bool     processCancel() ;                           // Advance the cancel sequence, true when finished.
+    inline bool isCancelling() const {
+      return cancelling;
+    }
+    bool     wasReset() ;                                // True once after a cancel ended in a reset
+    void     resetDecodeTime() ;                         // Clear SCI_DECODE_TIME, call before a new song starts.
+    bool     isDecoding() ;                              // True once the decoder has locked onto the stream.
+    void     readStatus ( uint16_t &decodeTime, uint16_t &hdat0,
+                          uint16_t &hdat1, uint16_t &audata ) ; // Playback status registers in one bus transaction
     void     setVolume ( uint8_t vol ) ;                 // Set the player volume.Level from 0-100,
     // higher is louder.
     void     setTone ( uint8_t* rtone ) ;                // Set the player baas/treble, 4 nibbles for
     // treble gain/freq and bass gain/freq
     uint8_t  getVolume() ;                               // Get the currenet volume setting.
     // higher is louder.
+    bool     loadPlugin ( File &file ) ;                 // Upload a compressed plugin/patch image. False if malformed.
+    void     beginBatch() ;                              // Acquire the SPI bus for several register accesses
+    void     endBatch() ;                                // Release the SPI bus again
     void     printDetails () ;       // Print configuration details to serial output.
     void     softReset() ;                               // Do a soft reset
     bool     testComm ( const char *header ) ;           // Test communication with module
@@ -0,0 +1,290 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "arena.h"
+#ifdef ESP_PLATFORM
+  #include "freertos/FreeRTOS.h"
+  #include "freertos/task.h"
+#endif
+
+Arena arena;
+
+// malloc calls after seal(), updated by the allocator wrappers on any core
+static volatile bool watching = false;
+static volatile uint32_t allocs = 0;
+static volatile uint32_t frees = 0;
+static volatile uint32_t lastAllocSize = 0;
+static void* volatile lastAllocCaller = NULL;
+
+// the ones made outside of allowMalloc(), by any task
+static volatile uint32_t unexpected = 0;
+static volatile uint32_t lastUnexpectedSize = 0;
+static void* volatile lastUnexpectedCaller = NULL;
+
+#ifdef ESP_PLATFORM
+  // per core the task which is inside allowMalloc() and how deep, the tasks are pinned
+  static void* volatile allowedTask[2] = {NULL, NULL};
+  static uint8_t allowedDepth[2] = {0, 0};
+#endif
+
+#if defined(ARENA_WATCH_MALLOC) && defined(ESP_PLATFORM)
+/**
+ * Linked in place of malloc and friends by -Wl,--wrap, so calls from the
+ * framework libraries are seen as well. Nothing here may allocate or print.
+ */
+static inline void countAlloc(size_t size, void* caller) {
+  if (watching) {
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    lastAllocSize = size;
+    lastAllocCaller = caller;
+    if (allowedTask[xPortGetCoreID()] != xTaskGetCurrentTaskHandle()) {
+      __atomic_fetch_add(&unexpected, 1, __ATOMIC_RELAXED);
+      lastUnexpectedSize = size;
+      lastUnexpectedCaller = caller;
+    }
+  }
+}
+
+extern "C" {
+  void* __real_malloc(size_t size);
+  void* __real_calloc(size_t n, size_t size);
+  void* __real_realloc(void* ptr, size_t size);
+  void __real_free(void* ptr);
+
+  void* __wrap_malloc(size_t size) {
+    countAlloc(size, __builtin_return_address(0));
+    return __real_malloc(size);
+  }
+
+  void* __wrap_calloc(size_t n, size_t size) {
+    countAlloc(n * size, __builtin_return_address(0));
+    return __real_calloc(n, size);
+  }
+
+  // only counted if it allocates or frees, resizing keeps the count of blocks
+  void* __wrap_realloc(void* ptr, size_t size) {
+    if (ptr == NULL) {
+      countAlloc(size, __builtin_return_address(0));
+    } else if (size == 0 && watching) {
+      __atomic_fetch_add(&frees, 1, __ATOMIC_RELAXED);
+    }
+    return __real_realloc(ptr, size);
+  }
+
+  void __wrap_free(void* ptr) {
+    if (ptr != NULL && watching) {
+      __atomic_fetch_add(&frees, 1, __ATOMIC_RELAXED);
+    }
+    __real_free(ptr);
+  }
+}
+#endif
+
+Arena::Arena() :
+  base(NULL),
+  size(0),
+  used(0),
+  psram(false),
+  sealed(false),
+  blockCount(0),
+  refused(0),
+  heapAtSeal(0),
+  largestAtSeal(0),
+  failedChecks(0),
+  lowestHeap(0),
+  reportedAllocs(0),
+  reportedUnexpected(0),
+  heldAtResume(0),
+  suspended(false)
+  {}
+
+/**
+ * Reserve the arena, sized for the buffers of the memory it ends up in.
+ */
+bool Arena::begin() {
+  if (psramFound()) {
+    base = (uint8_t*) ps_malloc(ARENA_PSRAM_BYTES);
+    if (base != NULL) {
+      size = ARENA_PSRAM_BYTES;
+      psram = true;
+    }
+  }
+  if (base == NULL) {
+    base = (uint8_t*) malloc(ARENA_BYTES);
+    size = base != NULL ? ARENA_BYTES : 0;
+  }
+  Serial.printf("Arena: %u bytes in %s\n", size, psram ? "PSRAM" : "internal RAM");
+  return base != NULL;
+}
+
+/**
+ * Hand out the next 4 byte aligned block, NULL if the arena is exhausted.
+ */
+void* Arena::alloc(const char* owner, uint32_t bytes) {
+  if (sealed) {
+    Serial.printf("Arena: %s allocated %u bytes after boot\n", owner, bytes);
+    abort();
+  }
+  bytes = (bytes + 3) & ~3UL;
+  if (bytes > size - used) {
+    Serial.printf("Arena: %u bytes for %s do not fit, %u left\n", bytes, owner, size - used);
+    refused++;
+    return NULL;
+  }
+  void* block = base + used;
+  used += bytes;
+  if (blockCount < ARENA_BLOCKS) {
+    blocks[blockCount].owner = owner;
+    blocks[blockCount].size = bytes;
+    blockCount++;
+  }
+  return block;
+}
+
+/**
+ * End of boot, from now on the heap is expected to stay as it is.
+ */
+void Arena::seal() {
+  sealed = true;
+  heapAtSeal = ESP.getFreeHeap();
+  largestAtSeal = ESP.getMaxAllocHeap();
+  lowestHeap = heapAtSeal;
+  watching = true;
+}
+
+/**
+ * For subsystems which need the heap while they run, like the WiFi driver.
+ * The checks pause until resume(), which takes the heap as it is then as
+ * the new reference, as not everything is given back.
+ */
+void Arena::suspend() {
+  suspended = true;
+}
+
+void Arena::resume() {
+  heldAtResume = allocs - frees;
+  reportedAllocs = allocs;
+  reportedUnexpected = unexpected;
+  heapAtSeal = ESP.getFreeHeap();
+  lowestHeap = heapAtSeal;
+  suspended = false;
+}
+
+/**
+ * Opening files and directory entries allocates in the framework (the File
+ * object, the stdio FILE and its buffer), there is no way to reuse them.
+ * Code which does so brackets it with allowMalloc() and disallowMalloc(),
+ * any other malloc of any task fails the next check. The brackets may nest,
+ * only tasks pinned to a core may use them.
+ */
+void Arena::allowMalloc() {
+  #ifdef ESP_PLATFORM
+    uint32_t core = xPortGetCoreID();
+    if (allowedDepth[core]++ == 0) {
+      allowedTask[core] = xTaskGetCurrentTaskHandle();
+    }
+  #endif
+}
+
+void Arena::disallowMalloc() {
+  #ifdef ESP_PLATFORM
+    uint32_t core = xPortGetCoreID();
+    if (allowedDepth[core] > 0 && --allowedDepth[core] == 0) {
+      allowedTask[core] = NULL;
+    }
+  #endif
+}
+
+bool Arena::inPsram() {
+  return psram;
+}
+
+/**
+ * The framework allocates for open files and the like. With
+ * ARENA_WATCH_MALLOC each new malloc is reported with its caller (decode it
+ * with addr2line). Any malloc outside of allowMalloc() fails the check, as do
+ * more than ARENA_HELD_BLOCKS held at once.
+ * Otherwise the free heap may dip by up to ARENA_HEAP_SLACK. A failed check
+ * is reported once per new low. Nothing is checked while suspended.
+ */
+bool Arena::check() {
+  if (!sealed || suspended) {
+    return true;
+  }
+  #if defined(ARENA_WATCH_MALLOC) && defined(ESP_PLATFORM)
+    uint32_t made = allocs;
+    uint32_t held = made - frees - heldAtResume;
+    if (made != reportedAllocs) {
+      // short enough for printf to get by without malloc
+      Serial.printf("Arena: %u mallocs, %u held, last %u B from %p\n",
+        made, held, lastAllocSize, lastAllocCaller);
+      reportedAllocs = made;
+    }
+    uint32_t stray = unexpected;
+    if (stray != reportedUnexpected) {
+      Serial.printf("Arena: %u unexpected, last %u B from %p\n",
+        stray, lastUnexpectedSize, lastUnexpectedCaller);
+      reportedUnexpected = stray;
+      failedChecks++;
+      return false;
+    }
+    if ((int32_t) held > ARENA_HELD_BLOCKS) {
+      failedChecks++;
+      return false;
+    }
+    return true;
+  #else
+    uint32_t heap = ESP.getFreeHeap();
+    if (heap + ARENA_HEAP_SLACK >= heapAtSeal) {
+      return true;
+    }
+    failedChecks++;
+    if (heap < lowestHeap) {
+      lowestHeap = heap;
+      Serial.printf("Arena: heap dropped by %u bytes since boot\n", heapAtSeal - heap);
+    }
+    return false;
+  #endif
+}
+
+// share of the free heap not usable for the largest possible block
+static uint8_t fragmentation(uint32_t free, uint32_t largest) {
+  return free ? 100 - (uint64_t) largest * 100 / free : 0;
+}
+
+void Arena::print() {
+  Serial.printf("Arena: %u of %u bytes used in %s, %s\n", used, size,
+    psram ? "PSRAM" : "internal RAM", sealed ? "sealed" : "open");
+  for (uint8_t i = 0; i < blockCount; i++) {
+    Serial.printf("  %-10s %8u\n", blocks[i].owner, blocks[i].size);
+  }
+  uint32_t heap = ESP.getFreeHeap();
+  uint32_t largest = ESP.getMaxAllocHeap();
+  Serial.printf("Heap: %u bytes free, largest block %u, fragmentation %u%%\n",
+    heap, largest, fragmentation(heap, largest));
+  if (sealed) {
+    Serial.printf("At boot: %u bytes free, largest block %u, fragmentation %u%%\n",
+      heapAtSeal, largestAtSeal, fragmentation(heapAtSeal, largestAtSeal));
+  }
+  Serial.printf("Allocations refused %u, failed heap checks %u\n", refused, failedChecks);
+  if (sealed) {
+    Serial.printf("Mallocs after boot %u (%u unexpected), frees %u\n", allocs, unexpected, frees);
+  }
+}
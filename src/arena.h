@@ -0,0 +1,89 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+
+/**
+ * Boot-time arena for all long living buffers. It is taken from the heap in
+ * one piece at the start of setup(), in PSRAM if present, and handed out in
+ * order without ever being freed. After seal() any allocation is a bug and
+ * stops the firmware, check() watches the heap for allocations made around
+ * the arena: with ARENA_WATCH_MALLOC every malloc is counted and those outside
+ * of allowMalloc() fail the check, otherwise only the free heap is compared,
+ * which misses anything below the slack.
+ */
+class Arena {
+
+  private:
+    struct Block {
+      const char* owner;
+      uint32_t size;
+    };
+
+    uint8_t* base;
+    uint32_t size;
+    uint32_t used;
+    bool psram;
+    bool sealed;
+    Block blocks[ARENA_BLOCKS];
+    uint8_t blockCount;
+    uint32_t refused;
+
+    // heap at seal() and the checks against it
+    uint32_t heapAtSeal;
+    uint32_t largestAtSeal;
+    uint32_t failedChecks;
+    uint32_t lowestHeap;
+    uint32_t reportedAllocs;
+    uint32_t reportedUnexpected;
+    int32_t heldAtResume;
+    volatile bool suspended;
+
+  public:
+    Arena();
+    bool begin();
+    void* alloc(const char* owner, uint32_t bytes);
+    void seal();
+    void suspend();
+    void resume();
+    void allowMalloc();
+    void disallowMalloc();
+    bool inPsram();
+    bool check();
+    void print();
+};
+
+extern Arena arena;
+
+/**
+ * Allows malloc for the calling task while in scope, see Arena::allowMalloc().
+ */
+class MallocAllowed {
+
+  public:
+    MallocAllowed() {
+      arena.allowMalloc();
+    }
+    ~MallocAllowed() {
+      arena.disallowMalloc();
+    }
+};
@@ -0,0 +1,82 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "battery.h"
+
+// LiPo discharge curve, mV to state of charge
+static const struct {
+  uint16_t mv;
+  uint8_t percent;
+} socCurve[] = {
+  {3270, 0}, {3610, 5}, {3690, 10}, {3710, 15}, {3730, 20}, {3750, 25},
+  {3770, 30}, {3790, 35}, {3800, 40}, {3820, 45}, {3840, 50}, {3850, 55},
+  {3870, 60}, {3910, 65}, {3950, 70}, {3980, 75}, {4020, 80}, {4080, 85},
+  {4110, 90}, {4150, 95}, {4200, 100}
+};
+
+Battery::Battery(uint8_t _pin) : 
+  pin(_pin),
+  filter(BATTERY_FILTER_SHIFT),
+  voltage(0),
+  soc(0)
+  {}
+
+void Battery::init() {
+  pinMode(pin, ANALOG);
+  // use the reference voltage from eFuse if the chip was calibrated in the factory
+  esp_adc_cal_value_t source = esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 
+    1100, &adcCharacteristics);
+  Serial.printf("Battery ADC calibrated from %s\n", 
+    source == ESP_ADC_CAL_VAL_EFUSE_VREF ? "eFuse Vref" : 
+    source == ESP_ADC_CAL_VAL_EFUSE_TP ? "eFuse two point" : "default Vref");
+  sample();
+}
+
+/**
+ * Take BATTERY_OVERSAMPLING readings, convert the average to mV at the
+ * battery and feed the filter.
+ */
+void Battery::sample() {
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < BATTERY_OVERSAMPLING; i++) {
+    sum += analogRead(pin);
+  }
+  uint32_t pinMv = esp_adc_cal_raw_to_voltage(sum / BATTERY_OVERSAMPLING, &adcCharacteristics);
+  voltage = filter.update(pinMv * BATTERY_DIVIDER_RATIO_MILLI / 1000);
+  soc = voltageToPercent(voltage);
+}
+
+/**
+ * Linear interpolation on the discharge curve.
+ */
+uint8_t Battery::voltageToPercent(uint16_t mv) {
+  const uint8_t n = sizeof(socCurve) / sizeof(socCurve[0]);
+  if (mv <= socCurve[0].mv) {
+    return 0;
+  }
+  for (uint8_t i = 1; i < n; i++) {
+    if (mv < socCurve[i].mv) {
+      uint16_t dmv = socCurve[i].mv - socCurve[i - 1].mv;
+      uint8_t dp = socCurve[i].percent - socCurve[i - 1].percent;
+      return socCurve[i - 1].percent + (uint32_t) (mv - socCurve[i - 1].mv) * dp / dmv;
+    }
+  }
+  return 100;
+}
@@ -0,0 +1,85 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+#include <esp_adc_cal.h>
+
+/**
+ * One pole IIR low pass in fixed point: y += (x - y) / 2^shift.
+ * The state keeps 8 fractional bits, so small steps are not lost.
+ * Independent of Arduino to allow testing it on the host.
+ */
+class BatteryFilter {
+
+  private:
+    int32_t state;   // value << 8
+    uint8_t shift;
+    bool primed;
+
+  public:
+    BatteryFilter(uint8_t _shift) : state(0), shift(_shift), primed(false) {}
+
+    uint16_t update(uint16_t x) {
+      if (!primed) {
+        // start at the first sample instead of ramping up from zero
+        state = (int32_t) x << 8;
+        primed = true;
+      } else {
+        state += (((int32_t) x << 8) - state) >> shift;
+      }
+      return value();
+    }
+
+    uint16_t value() const {
+      return (state + 128) >> 8;
+    }
+};
+
+/**
+ * Battery voltage and state of charge. sample() is called at a fixed rate
+ * by the scheduler, which makes the cutoff of the filter well defined.
+ * Reading the results is cheap.
+ */
+class Battery {
+
+  private:
+    uint8_t pin;
+    esp_adc_cal_characteristics_t adcCharacteristics;
+    BatteryFilter filter;
+    uint16_t voltage;       // mV, filtered
+    uint8_t soc;            // percent
+
+    static uint8_t voltageToPercent(uint16_t mv);
+
+  public:
+    Battery(uint8_t pin);
+    void init();
+    void sample();
+
+    inline uint16_t millivolts() const {
+      return voltage;
+    }
+
+    inline uint8_t percent() const {
+      return soc;
+    }
+};
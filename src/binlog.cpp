@@ -0,0 +1,108 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "binlog.h"
+#include "rambudget.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+BinaryLog binaryLog;
+
+static const uint8_t frameSync[2] = {0xA5, 0x5A};
+
+BinaryLog::BinaryLog() : writeIndex(0), readIndex(0) {
+  for (uint16_t i = 0; i < LOG_RECORDS; i++) {
+    records[i].sequence = 0;
+  }
+}
+
+/**
+ * Records written before are kept and sent once the task runs.
+ */
+void BinaryLog::start() {
+  TaskHandle_t handle;
+  xTaskCreatePinnedToCore(task, "log", LOG_TASK_STACK, this, LOG_TASK_PRIORITY, &handle, LOG_TASK_CORE);
+  ramBudget.task("log", handle, LOG_TASK_STACK);
+}
+
+void BinaryLog::task(void* log) {
+  while (true) {
+    ((BinaryLog*) log)->drain();
+    vTaskDelay(LOG_DRAIN_MS / portTICK_PERIOD_MS);
+  }
+}
+
+/**
+ * Send all complete records. If the writers lapped the reader, the
+ * overwritten records are reported as dropped. A slot being written is
+ * left for the next drain.
+ */
+void BinaryLog::drain() {
+  while (true) {
+    Record &record = records[readIndex & (LOG_RECORDS - 1)];
+    uint32_t sequence = __atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE);
+    if (sequence == readIndex + 1) {
+      uint16_t id = record.id;
+      uint32_t time = record.millis;
+      uint8_t argc = record.argc;
+      uint32_t args[LOG_MAX_ARGS];
+      memcpy(args, record.args, sizeof(args));
+      // the copy is only valid if no writer started on the slot meanwhile,
+      // a writer clears the sequence before touching the payload
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&record.sequence, __ATOMIC_RELAXED) == sequence) {
+        emit(id, time, argc, args);
+        readIndex++;
+        continue;
+      }
+      sequence = __atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE);
+    }
+    if (sequence == 0 || (int32_t) (sequence - (readIndex + 1)) <= 0) {
+      return;
+    }
+    // the slot holds a newer record, go on with the oldest one still in the ring
+    uint32_t oldest = __atomic_load_n(&writeIndex, __ATOMIC_RELAXED) - LOG_RECORDS;
+    uint32_t dropped = oldest - readIndex;
+    readIndex = oldest;
+    emit(LOG_DROPPED, millis(), 1, &dropped);
+  }
+}
+
+void BinaryLog::emit(uint16_t id, uint32_t time, uint8_t argc, const uint32_t* args) {
+  uint8_t frame[sizeof(frameSync) + 2 + 4 + 1 + 4 * LOG_MAX_ARGS];
+  uint8_t len = 0;
+  if (argc > LOG_MAX_ARGS) {
+    argc = LOG_MAX_ARGS;
+  }
+  frame[len++] = frameSync[0];
+  frame[len++] = frameSync[1];
+  frame[len++] = id;
+  frame[len++] = id >> 8;
+  for (uint8_t b = 0; b < 4; b++) {
+    frame[len++] = time >> (8 * b);
+  }
+  frame[len++] = argc;
+  for (uint8_t i = 0; i < argc; i++) {
+    for (uint8_t b = 0; b < 4; b++) {
+      frame[len++] = args[i] >> (8 * b);
+    }
+  }
+  Serial.write(frame, len);
+}
@@ -0,0 +1,119 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+
+/**
+ * Messages of the binary log. The format strings live only in the comments,
+ * tools/logdecode.py reads them from here. Append new messages at the end,
+ * the position is the ID sent over the wire.
+ */
+enum logMessage_t {
+  LOG_DROPPED,            // "%u log records dropped"
+  LOG_VOLUME,             // "Volume %u"
+  LOG_PLAYER_STATE,       // "Player state is now %u, was %u"
+  LOG_CARD_ID,            // "ID string: %08x"
+  LOG_MAPPING_SKIPPED,    // "Mapping line %u does not match"
+  LOG_MAPPING_LINE_OK,    // "Mapping line %u OK"
+  LOG_NUM_MESSAGES
+};
+
+#define LOG_MAX_ARGS 3
+
+/**
+ * Lock-free ring of fixed size records, filled from any task and drained by
+ * a low priority task, which writes them as frames to the serial port:
+ * LOG_FRAME_SYNC, message ID (16 bit), time in ms (32 bit), argument count
+ * (8 bit) and the arguments (32 bit each), all little endian.
+ */
+class BinaryLog {
+
+  private:
+    struct Record {
+      volatile uint32_t sequence;   // ticket + 1 once the record is complete, 0 while written
+      uint32_t millis;
+      uint16_t id;
+      uint8_t argc;
+      uint32_t args[LOG_MAX_ARGS];
+    };
+
+    Record records[LOG_RECORDS];
+    uint32_t writeIndex;
+    uint32_t readIndex;
+
+    void emit(uint16_t id, uint32_t time, uint8_t argc, const uint32_t* args);
+    static void task(void* log);
+
+  public:
+    BinaryLog();
+    void start();
+    void drain();
+
+    // a ticket, a few stores and the release of the record. The slot is
+    // marked as in progress first, a lapping writer may still be read.
+    inline void write(uint16_t id, uint8_t argc, uint32_t a0, uint32_t a1, uint32_t a2) {
+      uint32_t ticket = __atomic_fetch_add(&writeIndex, 1, __ATOMIC_RELAXED);
+      Record &record = records[ticket & (LOG_RECORDS - 1)];
+      __atomic_store_n(&record.sequence, 0, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      record.millis = millis();
+      record.id = id;
+      record.argc = argc;
+      record.args[0] = a0;
+      record.args[1] = a1;
+      record.args[2] = a2;
+      __atomic_store_n(&record.sequence, ticket + 1, __ATOMIC_RELEASE);
+    }
+    inline void write(uint16_t id) { write(id, 0, 0, 0, 0); }
+    inline void write(uint16_t id, uint32_t a0) { write(id, 1, a0, 0, 0); }
+    inline void write(uint16_t id, uint32_t a0, uint32_t a1) { write(id, 2, a0, a1, 0); }
+    inline void write(uint16_t id, uint32_t a0, uint32_t a1, uint32_t a2) { write(id, 3, a0, a1, a2); }
+};
+
+extern BinaryLog binaryLog;
+
+// levels above LOG_LEVEL are compiled out, the arguments still count as used
+#define LOG_LEVEL_ERROR   1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO    3
+#define LOG_LEVEL_DEBUG   4
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+  #define LOG_ERROR(...) binaryLog.write(__VA_ARGS__)
+#else
+  #define LOG_ERROR(...) do { if (0) binaryLog.write(__VA_ARGS__); } while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARNING
+  #define LOG_WARNING(...) binaryLog.write(__VA_ARGS__)
+#else
+  #define LOG_WARNING(...) do { if (0) binaryLog.write(__VA_ARGS__); } while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+  #define LOG_INFO(...) binaryLog.write(__VA_ARGS__)
+#else
+  #define LOG_INFO(...) do { if (0) binaryLog.write(__VA_ARGS__); } while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+  #define LOG_DEBUG(...) binaryLog.write(__VA_ARGS__)
+#else
+  #define LOG_DEBUG(...) do { if (0) binaryLog.write(__VA_ARGS__); } while (0)
+#endif
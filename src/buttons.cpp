@@ -20,33 +20,155 @@
  */
 #include "config.h"
 #include "buttons.h"
+#include "soc/gpio_struct.h"
 
-Buttons::Buttons() : oldState(0), state(0) {}
+static const DRAM_ATTR uint8_t pins[BUTTON_COUNT] = {BUTTON1, BUTTON2, BUTTON3, HEADPHONE_SWITCH};
+
+// Buttons that generate long press and repeat events. The headphone switch does not.
+static const DRAM_ATTR uint8_t repeatMask = 0x07;
+
+// shared with the interrupt handlers
+static volatile bool edgeSeen = false;
+static volatile bool debouncing = false;
+static volatile uint8_t stableState = 0;
+static uint8_t lastRaw = 0;
+static uint8_t stableTicks[BUTTON_COUNT];
+static uint16_t heldTicks[BUTTON_COUNT];
+
+static Buttons::Event queue[BUTTON_EVENT_QUEUE_LENGTH];
+static volatile uint8_t queueWrite = 0;
+static volatile uint8_t queueRead = 0;
+
+static hw_timer_t *timer = NULL;
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+Buttons::Buttons() : state(0) {}
 
 void Buttons::init() {
-  pinMode(BUTTON1, INPUT);
-  pinMode(BUTTON2, INPUT);
-  pinMode(BUTTON3, INPUT);
-  pinMode(HEADPHONE_SWITCH, INPUT);
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    pinMode(pins[i], INPUT);
+    // GPIO36/39 are known to see spurious edges while the ADC is in use,
+    // that's fine, an edge only starts the debouncer.
+    attachInterrupt(digitalPinToInterrupt(pins[i]), onEdge, CHANGE);
+  }
+  stableState = readPins();
+  lastRaw = stableState;
+  state = stableState;
+
+  timer = timerBegin(BUTTON_TIMER, 80, true);     // 1 MHz
+  timerAttachInterrupt(timer, onTimer, true);
+  timerAlarmWrite(timer, BUTTON_TICK_MS * 1000, true);
+  timerAlarmEnable(timer);
+}
+
+/**
+ * Pressed buttons read low, return one bit per button, set if pressed.
+ */
+uint8_t IRAM_ATTR Buttons::readPins() {
+  uint8_t result = 0;
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    uint8_t level = pins[i] < 32 ? (GPIO.in >> pins[i]) & 1 : (GPIO.in1.val >> (pins[i] - 32)) & 1;
+    if (!level) {
+      result |= 1 << i;
+    }
+  }
+  return result;
 }
 
-bool Buttons::read() {
+void IRAM_ATTR Buttons::onEdge() {
+  edgeSeen = true;
+}
+
+/**
+ * Called every BUTTON_TICK_MS. Returns immediately unless an edge was seen,
+ * a level is still bouncing or a button is held down.
+ */
+void IRAM_ATTR Buttons::onTimer() {
+  if (!edgeSeen && !debouncing) {
+    return;
+  }
+  edgeSeen = false;
+
+  uint8_t raw = readPins();
+  bool busy = false;
+
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    uint8_t bit = 1 << i;
+    if ((raw ^ lastRaw) & bit) {
+      stableTicks[i] = 0;
+    } else if (stableTicks[i] < BUTTON_DEBOUNCE_MS / BUTTON_TICK_MS) {
+      stableTicks[i]++;
+    }
+    if (stableTicks[i] < BUTTON_DEBOUNCE_MS / BUTTON_TICK_MS) {
+      busy = true;
+      continue;
+    }
 
-    state = (digitalRead(BUTTON1)) |  
-            (digitalRead(BUTTON2)) << 1 | 
-            (digitalRead(BUTTON3)) << 2 |
-            (digitalRead(HEADPHONE_SWITCH)) << 3;
-            
-    state ^= 255;
+    if ((raw ^ stableState) & bit) {
+      stableState ^= bit;
+      heldTicks[i] = 0;
+      queueEvent(i, (raw & bit) ? PRESS : RELEASE);
+    }
 
-    if (oldState != state) {
-        oldState  = state;
-        return true;
+    if ((stableState & bit) && (repeatMask & bit)) {
+      busy = true;
+      heldTicks[i]++;
+      if (heldTicks[i] == BUTTON_LONG_PRESS_MS / BUTTON_TICK_MS) {
+        queueEvent(i, LONG_PRESS);
+      }
+      if (heldTicks[i] >= BUTTON_REPEAT_DELAY_MS / BUTTON_TICK_MS &&
+          (heldTicks[i] - BUTTON_REPEAT_DELAY_MS / BUTTON_TICK_MS) % (BUTTON_REPEAT_INTERVAL_MS / BUTTON_TICK_MS) == 0) {
+        queueEvent(i, REPEAT);
+      }
     }
-    return false;
+  }
+
+  lastRaw = raw;
+  debouncing = busy;
+}
+
+void IRAM_ATTR Buttons::queueEvent(uint8_t button, EventType type) {
+  portENTER_CRITICAL_ISR(&mux);
+  uint8_t next = (queueWrite + 1) % BUTTON_EVENT_QUEUE_LENGTH;
+  if (next != queueRead) {                      // drop the event if the queue is full
+    queue[queueWrite].button = button;
+    queue[queueWrite].type = type;
+    queueWrite = next;
+  }
+  portEXIT_CRITICAL_ISR(&mux);
+}
+
+/**
+ * Make the debouncer look at the pins, e.g. after a light sleep which may
+ * have swallowed an edge.
+ */
+void Buttons::poke() {
+  edgeSeen = true;
+}
+
+/**
+ * True while the debouncer needs its timer, which stops during light sleep.
+ */
+bool Buttons::busy() {
+  return edgeSeen || debouncing;
+}
+
+/**
+ * Fetch the next event, false if there is none. Also updates state.
+ */
+bool Buttons::nextEvent(Event &event) {
+  bool result = false;
+  portENTER_CRITICAL(&mux);
+  if (queueRead != queueWrite) {
+    event = queue[queueRead];
+    queueRead = (queueRead + 1) % BUTTON_EVENT_QUEUE_LENGTH;
+    result = true;
+  }
+  state = stableState;
+  portEXIT_CRITICAL(&mux);
+  return result;
 }
 
 bool Buttons::buttonDown(uint8_t id) {
     return (state & (1 << id)) != 0;
 }
-
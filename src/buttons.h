@@ -21,18 +21,39 @@
 #pragma once
 #include "Arduino.h"
 
+/**
+ * Debounced buttons. GPIO interrupts only signal activity, a periodic timer
+ * interrupt debounces the levels and queues press, long press, repeat and
+ * release events for the main loop.
+ */
 class Buttons {
 
-  private:
-    uint8_t oldState;
-
   public:
+    enum EventType {
+      PRESS,
+      LONG_PRESS,
+      REPEAT,
+      RELEASE
+    };
+
+    struct Event {
+      uint8_t button;
+      EventType type;
+    };
+
     Buttons();
     void init();
-    bool read();
+    bool nextEvent(Event &event);
+    void poke();
+    bool busy();
 
     bool buttonDown(uint8_t id);
 
     uint8_t state;
 
-};
\ No newline at end of file
+  private:
+    static void IRAM_ATTR onEdge();
+    static void IRAM_ATTR onTimer();
+    static void IRAM_ATTR queueEvent(uint8_t button, EventType type);
+    static uint8_t IRAM_ATTR readPins();
+};
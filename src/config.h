@@ -54,5 +54,157 @@
 
 //#define FAIL_ON_FILE_NOT_FOUND
 #define FAST_BOOT
-#define MAX_PLAYLIST_LENGTH 32
-#define MAX_FILENAME_LENGTH 64
\ No newline at end of file
+#define MAX_FILENAME_LENGTH 96   // also the longest stream URL
+
+// Number of events kept by the card-to-sound latency trace
+#define TRACE_EVENTS 128
+
+// VS1053 patches/plugins, compressed plugin format as little endian 16 bit words.
+// Read from the SD card and cached in the SPIFFS partition.
+#define PLUGIN_FILE             "/patches.plg"
+#define PLUGIN_CACHE_FILE       "/patches.plg"
+#define PLUGIN_META_FILE        "/patches.meta"
+
+// Button debouncing and auto repeat, all times in ms
+#define BUTTON_COUNT                4
+#define BUTTON_TIMER                0
+#define BUTTON_TICK_MS              5
+#define BUTTON_DEBOUNCE_MS          20
+#define BUTTON_LONG_PRESS_MS        800
+#define BUTTON_REPEAT_DELAY_MS      400
+#define BUTTON_REPEAT_INTERVAL_MS   60
+#define BUTTON_EVENT_QUEUE_LENGTH   16
+
+// Cooperative scheduler
+#define SCHEDULER_MAX_TASKS         10
+#define DISPLAY_MAX_FPS             20
+#define MAPPING_CHECK_MS            5000  // poll for edits of the mapping file
+
+// Battery monitor. The divider ratio ((R1 + R2) / R2, times 1000) was derived from
+// the former "ADC 1000 is approx. 4.12V" estimate, measure and adjust it for your board.
+#define BATTERY_SAMPLE_MS           100
+#define BATTERY_OVERSAMPLING        16
+#define BATTERY_FILTER_SHIFT        4     // time constant approx. 16 samples
+#define BATTERY_DIVIDER_RATIO_MILLI 5110
+#define BATTERY_SHUTDOWN_PERCENT    1
+
+// Power governor. Light sleep garbles serial input, disable it for debugging.
+// It only starts while the player task waits between two iterations.
+#define GOVERNOR_LIGHT_SLEEP
+#define GOVERNOR_FULL_MHZ           240
+#define GOVERNOR_LOW_MHZ            80
+#define GOVERNOR_BOOST_MS           2000
+#define GOVERNOR_SLEEP_FILL         50    // percent of the ring buffer
+#define GOVERNOR_MIN_SLEEP_US       2000
+#define VS1053_FIFO_BYTES           2048
+
+// Power states, all times in ms. While in deep sleep the device checks for a card
+// every POWER_CARD_POLL_MS, after POWER_FAST_POLL_MS only every POWER_SLOW_POLL_MS,
+// and powers off completely after POWER_OFF_MS. Every poll is a boot, so the slow
+// interval sets the sleep current. POWER_WAKE_BUTTON wakes the device at once.
+#define POWER_IDLE_MS               60000UL
+#define POWER_SLEEP_MS              (15 * 60000UL)
+#define POWER_CARD_POLL_MS          1000UL
+#define POWER_FAST_POLL_MS          (5 * 60000UL)
+#define POWER_SLOW_POLL_MS          15000UL
+#define POWER_OFF_MS                (12 * 3600000UL)
+#define POWER_WAKE_BUTTON           BUTTON2
+
+// Read-ahead buffer. In PSRAM if present, the SD card is then read in long bursts
+// whenever the buffer drops below the refill mark and stays idle in between.
+#define RINGBUFFER_SIZE             20000
+#define RINGBUFFER_PSRAM_SIZE       (2 * 1024 * 1024UL)
+#define RINGBUFFER_REFILL_PERCENT   50
+#define SD_READ_CHUNK               4096  // bytes per process() call while refilling
+
+// Head cache for re-inserted cards, the larger size is used with PSRAM
+#define HEAD_CACHE_ENTRIES          4
+#define HEAD_CACHE_BYTES            4096
+#define HEAD_CACHE_PSRAM_BYTES      (64 * 1024UL)
+
+// Validated mapping lines remembered across checks, longer mapping files are
+// checked in full after each edit
+#define MAPPING_CACHE_LINES         1024
+#define MAPPING_CACHE_PSRAM_LINES   16384
+
+// Boot-time arena for the buffers above, the firmware's own code allocates no
+// heap after setup(). The framework's transient allocations (open files) may
+// take up to the slack, the WiFi driver and lwIP are not checked while WiFi is on.
+// ARENA_WATCH_MALLOC counts every malloc after setup() through the linker
+// wrappers set in platformio.ini, remove both together. Up to
+// ARENA_HELD_BLOCKS of them (open files, sockets) may be held at a time.
+#define ARENA_BYTES                 (RINGBUFFER_SIZE + HEAD_CACHE_ENTRIES * HEAD_CACHE_BYTES + MAPPING_CACHE_LINES * 4)
+#define ARENA_PSRAM_BYTES           (RINGBUFFER_PSRAM_SIZE + HEAD_CACHE_ENTRIES * HEAD_CACHE_PSRAM_BYTES + MAPPING_CACHE_PSRAM_LINES * 4)
+#define ARENA_BLOCKS                8
+#define ARENA_CHECK_MS              10000
+#define ARENA_HEAP_SLACK            8192
+#define ARENA_WATCH_MALLOC
+#define ARENA_HELD_BLOCKS           16
+
+// Container layouts (FLAC metadata, MP4 atom order) of recently played files
+#define LAYOUT_CACHE_ENTRIES        16
+#define MP4_PATCH_CHUNK             512   // bytes of moov read per process() call
+
+// System sounds, played from the SPIFFS partition (see data/)
+#define SYSTEM_SOUND_STARTUP        "/startup.mp3"
+#define SYSTEM_SOUND_ERROR          "/error.mp3"
+
+// Decoder telemetry
+#define TELEMETRY_POLL_MS           250
+#define TELEMETRY_STALL_MS          3000
+
+// Network streams, "#http://..." entries of the mapping. The SD card holds
+// WIFI_CONFIG_FILE, the SSID on the first line and the password on the second.
+// WiFi is switched on for a stream and off again after WIFI_IDLE_OFF_MS.
+#define HTTP_STREAMS
+#define WIFI_CONFIG_FILE            "/wifi.txt"
+#define WIFI_CONNECT_TIMEOUT_MS     15000
+#define WIFI_IDLE_OFF_MS            30000
+#define HTTP_HOST_LENGTH            64
+#define HTTP_LINE_LENGTH            128   // longer header lines are cut
+#define HTTP_TITLE_LENGTH           64
+#define HTTP_STALL_MS               5000  // no data for this long counts as a lost connection
+#define HTTP_RECONNECT_MS           500   // first retry, doubled per failed attempt
+#define HTTP_RECONNECT_MAX_MS       8000
+#define HTTP_RECONNECT_ATTEMPTS     8
+#define HTTP_MAX_REDIRECTS          3
+
+// Jitter buffer of network streams, the target fill before playback starts
+// grows by half on every underrun and shrinks by an eighth per quiet period
+#define JITTER_MIN_BYTES            16000 // 1 s at 128 kbps
+#define JITTER_MAX_BYTES            (256 * 1024UL)
+#define JITTER_SHRINK_MS            30000
+
+// Player task, the Arduino loop runs on core 1
+#define PLAYER_TASK_CORE            0
+#define PLAYER_TASK_PRIORITY        3
+#define PLAYER_TASK_STACK           8192
+#define PLAYER_QUEUE_LENGTH         8
+#define PLAYER_SCAN_PER_STEP        4     // directory entries read per iteration
+
+// Binary log, decoded on the host by tools/logdecode.py. Level 1 error,
+// 2 warning, 3 info, 4 debug, 0 compiles all log calls out.
+#ifndef LOG_LEVEL
+  #define LOG_LEVEL                 3
+#endif
+#define LOG_RECORDS                 256   // power of two
+#define LOG_DRAIN_MS                50
+#define LOG_TASK_CORE               1
+#define LOG_TASK_PRIORITY           1
+#define LOG_TASK_STACK              2048
+
+// Sampling profiler, one hardware timer per core. The period is prime, so the
+// samples do not run in lock step with the 1 ms FreeRTOS tick.
+#define PROFILE_TIMER_CORE0         2
+#define PROFILE_TIMER_CORE1         3
+#define PROFILE_PERIOD_US           997
+#define PROFILE_SLOTS               512   // per core, power of two
+#define PROFILE_BUCKET_BITS         3     // PCs are counted in 8 byte buckets
+
+// Subsystems listed in the RAM budget report
+#define RAM_BUDGET_ENTRIES          16
+#define LOOP_TASK_STACK             8192  // set by the Arduino core
+
+// SPI transaction trace for tools/spitrace.py, costs 12 bytes per transaction
+//#define SPI_TRACE
+#define SPI_TRACE_TRANSACTIONS      2048
@@ -0,0 +1,292 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "container.h"
+
+void StreamLayout::plain(uint32_t start, uint32_t end) {
+  segmentCount = 1;
+  segments[0].start = start;
+  segments[0].end = end;
+  prefixLength = 0;
+  patchSegment = -1;
+  chunkOffsetDelta = 0;
+}
+
+static bool readAt(File &file, uint32_t position, uint8_t* buf, uint32_t len) {
+  return file.seek(position) && file.read(buf, len) == len;
+}
+
+/**
+ * Keep only STREAMINFO of the metadata blocks. Pictures and padding can be
+ * hundreds of KB the decoder has no use for.
+ */
+static void analyzeFlac(File &file, StreamLayout &layout) {
+  uint32_t position = layout.segments[0].start + 4;
+  uint32_t skipped = 0;
+  bool haveInfo = false;
+  bool last = false;
+  uint8_t header[FLAC_BLOCK_HEADER];
+
+  while (!last) {
+    uint8_t type;
+    if (!readAt(file, position, header, FLAC_BLOCK_HEADER)) {
+      return;
+    }
+    uint32_t length = flacBlockHeader(header, last, type);
+    if (type == 0 && length == FLAC_STREAMINFO && !haveInfo) {
+      if (!readAt(file, position + FLAC_BLOCK_HEADER, layout.prefix + 4 + FLAC_BLOCK_HEADER, FLAC_STREAMINFO)) {
+        return;
+      }
+      haveInfo = true;
+    } else {
+      skipped += FLAC_BLOCK_HEADER + length;
+    }
+    position += FLAC_BLOCK_HEADER + length;
+    if (position > layout.fileSize) {
+      return;
+    }
+  }
+
+  if (!haveInfo || skipped == 0) {
+    return;
+  }
+
+  // STREAMINFO becomes the last metadata block
+  memcpy(layout.prefix, "fLaC", 4);
+  layout.prefix[4] = 0x80;
+  layout.prefix[5] = 0;
+  layout.prefix[6] = 0;
+  layout.prefix[7] = FLAC_STREAMINFO;
+  layout.prefixLength = FLAC_PREFIX_LENGTH;
+  layout.segments[0].start = position;
+  Serial.printf("FLAC: skipping %u bytes of metadata\n", skipped);
+}
+
+/**
+ * Locate moov and mdat. If moov follows mdat the decoder would have to read
+ * through all audio data first, so moov is sent in front of mdat and the chunk
+ * offsets are moved accordingly.
+ */
+static void analyzeMp4(File &file, StreamLayout &layout) {
+  uint32_t start = layout.segments[0].start;
+  uint32_t position = start;
+  uint32_t moovStart = 0, moovEnd = 0;
+  uint32_t mdatStart = 0, mdatEnd = 0;
+  uint8_t header[MP4_ATOM_HEADER];
+  char type[5];
+
+  while (position + MP4_ATOM_HEADER <= layout.fileSize) {
+    if (!readAt(file, position, header, MP4_ATOM_HEADER)) {
+      return;
+    }
+    uint32_t size = mp4AtomHeader(header, type);
+    if (size == 1) {
+      // 64 bit size, only files below 4 GB are supported anyway
+      if (file.read(header, MP4_ATOM_HEADER) != MP4_ATOM_HEADER || readBigEndian(header, 4) != 0) {
+        return;
+      }
+      size = readBigEndian(header + 4, 4);
+    } else if (size == 0) {
+      size = layout.fileSize - position;
+    }
+    if (size < MP4_ATOM_HEADER || size > layout.fileSize - position) {
+      return;
+    }
+    if (strcmp(type, "moov") == 0) {
+      moovStart = position;
+      moovEnd = position + size;
+    } else if (strcmp(type, "mdat") == 0) {
+      mdatStart = position;
+      mdatEnd = position + size;
+    }
+    position += size;
+  }
+
+  if (moovEnd == 0 || mdatEnd == 0 || moovStart < mdatStart) {
+    return;
+  }
+
+  layout.segmentCount = 3;
+  layout.segments[0].end = mdatStart;
+  layout.segments[1].start = moovStart;
+  layout.segments[1].end = moovEnd;
+  layout.segments[2].start = mdatStart;
+  layout.segments[2].end = mdatEnd;
+  layout.patchSegment = 1;
+  layout.chunkOffsetDelta = (int32_t) (moovEnd - moovStart) - (int32_t) start;
+  Serial.printf("MP4: moving moov (%u bytes) in front of mdat\n", moovEnd - moovStart);
+}
+
+/**
+ * Work out how to send a file: skip an ID3v2 tag, sniff the format and apply
+ * the container specific handling. Unknown data is sent as it is.
+ */
+bool analyzeStream(File &file, StreamLayout &layout) {
+  layout.format = FORMAT_UNKNOWN;
+  layout.fileSize = file.size();
+  layout.plain(0, layout.fileSize);
+
+  uint8_t head[SNIFF_LENGTH];
+  memset(head, 0, sizeof(head));
+  if (!readAt(file, 0, head, SNIFF_LENGTH)) {
+    return false;
+  }
+
+  uint32_t start = id3v2TagLength(head);
+  if (start >= layout.fileSize) {
+    start = 0;
+  }
+  if (start) {
+    Serial.printf("Found ID3v2 tag at beginning, skipping %u bytes\n", start);
+    memset(head, 0, sizeof(head));
+    readAt(file, start, head, SNIFF_LENGTH);
+  }
+  layout.segments[0].start = start;
+  layout.format = sniffFormat(head);
+
+  switch (layout.format) {
+    case FORMAT_FLAC:
+      analyzeFlac(file, layout);
+      break;
+    case FORMAT_AAC:
+      analyzeMp4(file, layout);
+      break;
+    default:
+      // Ogg pages are checksummed and numbered, the headers are passed through
+      break;
+  }
+  return true;
+}
+
+void ChunkOffsetPatcher::begin(int32_t _delta) {
+  delta = _delta;
+  position = 0;
+  depth = 0;
+  skipUntil = 0;
+  tableEnd = 0;
+  entrySize = 0;
+}
+
+/**
+ * Walk the atom tree inside moov, descending into the containers on the way
+ * to the sample tables.
+ */
+uint32_t ChunkOffsetPatcher::patch(uint8_t* data, uint32_t len) {
+  uint32_t i = 0;
+  while (i < len) {
+    while (depth > 0 && position >= containerEnds[depth - 1]) {
+      depth--;
+    }
+
+    if (position < tableEnd) {
+      if (len - i < entrySize) {
+        return i;
+      }
+      uint32_t offset = readBigEndian(data + i + entrySize - 4, 4) + delta;
+      for (uint8_t b = 0; b < 4; b++) {
+        data[i + entrySize - 1 - b] = offset >> (8 * b);
+      }
+      i += entrySize;
+      position += entrySize;
+      continue;
+    }
+
+    if (position < skipUntil) {
+      uint32_t n = skipUntil - position;
+      if (n > len - i) {
+        n = len - i;
+      }
+      i += n;
+      position += n;
+      continue;
+    }
+
+    // atom header, stco and co64 also need version, flags and entry count
+    if (len - i < MP4_ATOM_HEADER) {
+      return i;
+    }
+    char type[5];
+    uint32_t size = mp4AtomHeader(data + i, type);
+    if (size < MP4_ATOM_HEADER) {
+      // malformed or 64 bit sized, leave the rest untouched
+      skipUntil = 0xFFFFFFFF;
+      continue;
+    }
+    bool stco = strcmp(type, "stco") == 0;
+    bool co64 = strcmp(type, "co64") == 0;
+    if (stco || co64) {
+      if (len - i < MP4_ATOM_HEADER + 8) {
+        return i;
+      }
+      // 64 bit offsets stay below 4 GB, only their low word is patched
+      entrySize = stco ? 4 : 8;
+      uint32_t count = readBigEndian(data + i + MP4_ATOM_HEADER + 4, 4);
+      tableEnd = position + MP4_ATOM_HEADER + 8 + count * entrySize;
+      skipUntil = position + size;
+      if (tableEnd > skipUntil) {
+        tableEnd = skipUntil;
+      }
+      i += MP4_ATOM_HEADER + 8;
+      position += MP4_ATOM_HEADER + 8;
+    } else if ((strcmp(type, "moov") == 0 || strcmp(type, "trak") == 0 || strcmp(type, "mdia") == 0
+        || strcmp(type, "minf") == 0 || strcmp(type, "stbl") == 0) && depth < 8) {
+      containerEnds[depth++] = position + size;
+      i += MP4_ATOM_HEADER;
+      position += MP4_ATOM_HEADER;
+    } else {
+      skipUntil = position + size;
+    }
+  }
+  return i;
+}
+
+LayoutCache::LayoutCache() :
+  useCounter(0)
+  {
+  for (uint8_t i = 0; i < LAYOUT_CACHE_ENTRIES; i++) {
+    entries[i].valid = false;
+  }
+}
+
+bool LayoutCache::lookup(const char* filename, uint32_t fileSize, StreamLayout &layout) {
+  for (uint8_t i = 0; i < LAYOUT_CACHE_ENTRIES; i++) {
+    Entry &entry = entries[i];
+    if (entry.valid && entry.layout.fileSize == fileSize && strncmp(entry.filename, filename, MAX_FILENAME_LENGTH) == 0) {
+      entry.lastUsed = ++useCounter;
+      layout = entry.layout;
+      return true;
+    }
+  }
+  return false;
+}
+
+void LayoutCache::store(const char* filename, const StreamLayout &layout) {
+  Entry* entry = &entries[0];
+  for (uint8_t i = 1; i < LAYOUT_CACHE_ENTRIES && entry->valid; i++) {
+    if (!entries[i].valid || entries[i].lastUsed < entry->lastUsed) {
+      entry = &entries[i];
+    }
+  }
+  strncpy(entry->filename, filename, MAX_FILENAME_LENGTH);
+  entry->filename[MAX_FILENAME_LENGTH - 1] = 0;
+  entry->layout = layout;
+  entry->lastUsed = ++useCounter;
+  entry->valid = true;
+}
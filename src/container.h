@@ -0,0 +1,99 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include <FS.h>
+#include "Arduino.h"
+#include "config.h"
+#include "tags.h"
+
+#define LAYOUT_MAX_SEGMENTS 3
+#define FLAC_PREFIX_LENGTH  (4 + FLAC_BLOCK_HEADER + FLAC_STREAMINFO)
+
+/**
+ * How a file is sent to the decoder: a header built in memory (may be empty)
+ * followed by up to LAYOUT_MAX_SEGMENTS byte ranges of the file. The MP4
+ * chunk offsets in segment patchSegment are moved by chunkOffsetDelta.
+ */
+struct StreamLayout {
+  struct Segment {
+    uint32_t start;
+    uint32_t end;
+  };
+
+  audioFormat_t format;
+  uint32_t fileSize;
+  uint8_t segmentCount;
+  Segment segments[LAYOUT_MAX_SEGMENTS];
+  uint8_t prefix[FLAC_PREFIX_LENGTH];
+  uint8_t prefixLength;
+  int8_t patchSegment;
+  int32_t chunkOffsetDelta;
+
+  // the file is sent as it is from some offset on
+  bool simple() const { return segmentCount == 1 && prefixLength == 0; }
+  void plain(uint32_t start, uint32_t end);
+};
+
+bool analyzeStream(File &file, StreamLayout &layout);
+
+/**
+ * Adds a constant to all entries of the stco/co64 tables while a moov atom
+ * is streamed through it. patch() returns how many bytes are final, the
+ * rest (an incomplete header or table entry) has to be passed again.
+ */
+class ChunkOffsetPatcher {
+
+  public:
+    void begin(int32_t delta);
+    uint32_t patch(uint8_t* data, uint32_t len);
+
+  private:
+    int32_t delta;
+    uint32_t position;
+    uint32_t containerEnds[8];
+    uint8_t depth;
+    uint32_t skipUntil;
+    uint32_t tableEnd;
+    uint8_t entrySize;
+};
+
+/**
+ * Remembers the layout of the last LAYOUT_CACHE_ENTRIES files, so container
+ * headers are only walked once. Entries are checked against the file size.
+ */
+class LayoutCache {
+
+  public:
+    LayoutCache();
+    bool lookup(const char* filename, uint32_t fileSize, StreamLayout &layout);
+    void store(const char* filename, const StreamLayout &layout);
+
+  private:
+    struct Entry {
+      char filename[MAX_FILENAME_LENGTH];
+      StreamLayout layout;
+      uint32_t lastUsed;
+      bool valid;
+    };
+
+    Entry entries[LAYOUT_CACHE_ENTRIES];
+    uint32_t useCounter;
+};
@@ -35,26 +35,60 @@
 #include "mapper.h"
 #include "player.h"
 #include "fatal.h"
+#include "trace.h"
+#include "binlog.h"
+#include "scheduler.h"
+#include "battery.h"
+#include "governor.h"
+#include "power.h"
+#include "profiler.h"
+#include "spitrace.h"
+#include "rambudget.h"
+#include "arena.h"
+#include "wlan.h"
 
 VS1053          vs1053(VS1053_XCS_PIN, VS1053_XDCS_PIN, VS1053_DREQ_PIN, VS1053_XRESET_PIN);
 RFID            rfid(MFRC522_CS_PIN, MFRC522_RST_PIN);
 SDCard          sd(SD_CS_PIN);
 
+Mapper          mapper;
+
 #ifdef OLED
   Oled            oled(DISPLAY_ADDRESS);
   Fatal           fatal(oled);
-  Player          player(fatal, oled, vs1053);
+  Player          player(fatal, oled, vs1053, mapper);
 #else
   Fatal           fatal;
-  Player          player(fatal, vs1053);
+  Player          player(fatal, vs1053, mapper);
 #endif
 
-Mapper          mapper;
 Buttons         buttons;
+Scheduler       scheduler;
+Battery         battery(ADC_BATT);
+Governor        governor(player);
+#ifdef OLED
+  Power           power(player, rfid, battery, oled);
+#else
+  Power           power(player, rfid, battery);
+#endif
 
 void setup() {
 
   Serial.begin(115200);                            
+
+  // returns only if woken up by a card or after a cold boot, nothing before
+  // this may allocate or start tasks, every card poll would pay for it
+  bool wokenByCard = Power::checkWakeup(rfid);
+
+  // all long living buffers are taken from the arena during setup()
+  ramBudget.begin("arena", sizeof(arena));
+  arena.begin();
+  ramBudget.end();
+
+  ramBudget.begin("log", sizeof(binaryLog));
+  binaryLog.start();
+  ramBudget.end();
+
   Serial.println("\nStarting...");
 
   // Initialize GPIOs for LEDs
@@ -75,10 +109,14 @@ void setup() {
   digitalWrite(AMP_ENABLE, LOW); 
 
   // Initialize buttons
+  ramBudget.begin("buttons", sizeof(buttons));
   buttons.init();
+  ramBudget.end();
 
-  // Initialize GPIO for battery voltage
-  pinMode(ADC_BATT, ANALOG);
+  // Initialize battery monitoring
+  ramBudget.begin("battery", sizeof(battery));
+  battery.init();
+  ramBudget.end();
   pinMode(LOW_BATT, INPUT);
   pinMode(SHUTDOWN, OUTPUT);
   digitalWrite(SHUTDOWN, LOW);
@@ -88,8 +126,11 @@ void setup() {
   // Initialize I²C bus
   Wire.begin(I2C_SDA_PIN, I2C_SCL_PIN);
   #ifdef OLED
+    ramBudget.begin("display", sizeof(oled) + sizeof(fatal));
     oled.init();
-    oled.loadingBar(0);  
+    ramBudget.end();
+    oled.loadingBar(0);
+    oled.update();
   #endif  
   Wire.setClock(TWI_CLOCK);
   Serial.println("I²C init completed.");
@@ -98,24 +139,52 @@ void setup() {
   SPI.begin(SPI_SCK_PIN, SPI_MISO_PIN, SPI_MOSI_PIN);
   #ifdef OLED
     oled.loadingBar(25);
+    oled.update();
   #endif
   Serial.println("SPI init completed.");
 
+  // initialize player, system sounds are in flash and play in the player task
+  // while the SD card and the mapping are checked
+  ramBudget.begin("player", sizeof(player));
+  player.init();
+  player.start();
+  ramBudget.end();
+  if (!wokenByCard) {
+    player.playSystemSound(SYSTEM_SOUND_STARTUP);
+  }
+
   // Initialize RFID reader
+  ramBudget.begin("rfid", sizeof(rfid));
   rfid.init();
+  ramBudget.end();
 
   #ifdef OLED
     oled.loadingBar(50);
+    oled.update();
   #endif
   
   // Initialize SD card reader
-  if (!sd.init()) {
+  ramBudget.begin("sd", sizeof(sd));
+  bool sdReady = sd.init();
+  ramBudget.end();
+  if (!sdReady) {
+      player.playSystemSound(SYSTEM_SOUND_ERROR);
       fatal.fatal("SD card error", "init failed");
   }
+  player.updatePlugins();
 
+  #ifdef HTTP_STREAMS
+    // only reads the credentials, the radio is switched on for a stream
+    ramBudget.begin("wlan", sizeof(wlan));
+    wlan.begin();
+    ramBudget.end();
+  #endif
+
+  ramBudget.begin("mapper", sizeof(mapper));
   Mapper::MapperError err = mapper.init(); 
+  ramBudget.end();
   if (err != Mapper::MapperError::OK) {
-    //player.play("/error.mp3");
+    player.playSystemSound(SYSTEM_SOUND_ERROR);
     switch(err) {
       case Mapper::MapperError::MALFORMED_LINE_SYNTAX:
         fatal.fatal("Mapping error", "Syntax error");
@@ -136,98 +205,292 @@ void setup() {
     }    
   }
 
-  // initialize player
-  player.init();
+  #ifdef OLED
+    oled.clear();
+  #endif
 
-  player.play("/startup.mp3");
+  ramBudget.begin("scheduler", sizeof(scheduler));
+  scheduler.add("rfid",    handleCard,           100,                    50,   1);
+  #ifdef OLED
+    scheduler.add("display", updateDisplay,      1000 / DISPLAY_MAX_FPS, 100,  0);
+  #endif
+  scheduler.add("battery", sampleBattery,        BATTERY_SAMPLE_MS,      50,   0);
+  scheduler.add("power",   handlePower,          1000,                   500,  0);
+  scheduler.add("status",  handlePlayerStatus,   50,                     100,  0);
+  scheduler.add("serial",  handleSerialCommands, 100,                    500,  0);
+  scheduler.add("mapping", checkMapping,         MAPPING_CHECK_MS,       1000, 0);
+  scheduler.add("arena",   checkArena,           ARENA_CHECK_MS,         1000, 0);
+  scheduler.resetStats();
+  ramBudget.end();
+  ramBudget.begin("power", sizeof(governor) + sizeof(power));
+  governor.init();
+  power.init();
+  ramBudget.end();
+  ramBudget.add("vs1053", sizeof(vs1053));
+  ramBudget.add("trace", sizeof(latencyTrace));
+  ramBudget.add("profiler", sizeof(profiler));
+  #ifdef SPI_TRACE
+    ramBudget.add("spitrace", sizeof(spiTrace));
+  #endif
+  ramBudget.task("loop", xTaskGetCurrentTaskHandle(), LOOP_TASK_STACK);
+  arena.seal();
 
-  oled.clear();  
+  Serial.printf("Boot completed after %u ms (%s)\n", (uint32_t) millis(), wokenByCard ? "card wake up" : "cold boot");
 }
 
-uint16_t lpf = 0;
-
+/**
+ * Volume up/down on press and auto repeat, the volume bar follows the player
+ * status in handlePlayerStatus(). A long press of the middle button changes
+ * the play mode.
+ */
+void handleButtons() {
+  Buttons::Event event;
+  while (buttons.nextEvent(event)) {
+    governor.boost();
+    power.activity();
+    #ifdef OLED
+    if (event.type == Buttons::PRESS || event.type == Buttons::RELEASE) {
+      oled.buttons(buttons.state);
+    }
+    #endif
+    if (event.type == Buttons::LONG_PRESS && event.button == 1) {
+      player.cycleMode();
+      continue;
+    }
+    if (event.type != Buttons::PRESS && event.type != Buttons::REPEAT) {
+      continue;
+    }
+    switch (event.button) {
+      case 0:
+        player.increaseVolume();
+        break;
+      case 2:
+        player.decreaseVolume();
+        break;
+    }
+  }
+}
 
-void loop() {
+/**
+ * Single character debug commands on the serial console:
+ * t - dump the card-to-sound latency trace
+ * s - print and reset the scheduler statistics
+ * g - print and reset the power governor statistics
+ * b - print and reset the read-ahead buffer and SD card statistics
+ * i - print the decoder telemetry
+ * n - next track
+ * m - next play mode (in order, shuffle, repeat, shuffle and repeat)
+ * < - seek back 10 seconds
+ * > - seek forward 10 seconds
+ * p - start the sampling profiler, resp. stop it and dump the samples
+ * x - start the SPI trace, resp. stop it and dump the transactions (SPI_TRACE only)
+ * r - print the RAM budget and the arena and heap report
+ */
+void handleSerialCommands() {
+  if (!Serial.available()) {
+    return;
+  }
+  // the reports print lines too long for printf's stack buffer
+  MallocAllowed printing;
+  switch (Serial.read()) {
+    case 't':
+      latencyTrace.dump();
+      break;
+    case 's':
+      scheduler.printStats();
+      scheduler.resetStats();
+      break;
+    case 'g':
+      governor.printStats();
+      break;
+    case 'b':
+      player.requestStats();
+      break;
+    case 'i':
+      player.requestTelemetry();
+      break;
+    case 'n':
+      player.next();
+      break;
+    case 'm':
+      player.cycleMode();
+      break;
+    case '<':
+      player.seek(-10);
+      break;
+    case '>':
+      player.seek(10);
+      break;
+    case 'p':
+      if (profiler.isRunning()) {
+        profiler.dump();
+      } else {
+        profiler.start();
+      }
+      break;
+    case 'r':
+      ramBudget.print();
+      arena.print();
+      break;
+    #ifdef SPI_TRACE
+      case 'x':
+        if (spiTrace.isRunning() || spiTrace.recorded()) {
+          spiTrace.dump();
+        } else {
+          spiTrace.start();
+        }
+        break;
+    #endif
+  }
+}
 
-  bool changed = buttons.read();
+#ifdef OLED
+void updateDisplay() {
+  oled.update();
+}
+#endif
 
-  #ifdef OLED
-  if (changed) {
-    oled.buttons(buttons.state);
-  }  
-  #endif  
+/**
+ * Follow the snapshot published by the player task: report the result of
+ * card lookups and mapping checks and show volume changes and playback progress.
+ */
+void handlePlayerStatus() {
+  PlayerStatus status = player.status();
 
-  // Cheapo one pole IIR low pass filter with unknown cutoff frequency (because sample rate is unknown).
-  // This is good enough for battery monitoring though.
-  //
-  // lpf:
-  // 0 is 0V battery voltage  
-  // 1000 is approx. 4.12V battery voltage
-  // in between linear (voltage divider)
-  uint16_t batt = analogRead(ADC_BATT);
-  uint16_t newLpf = (float)lpf * 0.95 + (float)batt * 0.05;
-  lpf = newLpf;
-
-
-  uint8_t lowBattFromPowerModule = digitalRead(LOW_BATT);
-  if (lowBattFromPowerModule == 0) {
-    pinMode(SHUTDOWN, OUTPUT);
-    digitalWrite(SHUTDOWN, 1);
+  static uint16_t handledCards = 0;
+  if (status.cardSequence != handledCards) {
+    handledCards = status.cardSequence;
+    handleCardResult(status.cardResult);
   }
 
-  if (player.idleTime > 700000000) { // approx 15 min shutdown timer
-    pinMode(SHUTDOWN, OUTPUT);
-    digitalWrite(SHUTDOWN, 1);
-  }
-  
-  // Volume Control
-  if (buttons.buttonDown(0)) {
-    player.increaseVolume();
+  static uint16_t handledMappings = 0;
+  if (status.mappingSequence != handledMappings) {
+    handledMappings = status.mappingSequence;
+    handleMappingResult(status.mappingResult);
   }
 
-  if (buttons.buttonDown(2)) {
-    player.decreaseVolume();
+  #ifdef OLED
+    static int16_t shownVolume = -1;
+    if (shownVolume >= 0 && status.volume != shownVolume) {
+      oled.volumeBar(status.volume);
+    }
+    shownVolume = status.volume;
+
+    static int8_t shownMode = -1;
+    int8_t mode = (status.shuffle ? 1 : 0) | (status.repeat ? 2 : 0);
+    if (shownMode >= 0 && mode != shownMode) {
+      const char* modes[] = {"In order", "Shuffle", "Repeat", "Shuffle + repeat"};
+      oled.trackName((char*) modes[mode]);
+    }
+    shownMode = mode;
+
+    static uint16_t shownSeconds = 0xFFFF;
+    if (status.state == PLAYING && status.elapsedSeconds != shownSeconds) {
+      shownSeconds = status.elapsedSeconds;
+      oled.playbackInfo(shownSeconds, status.kbps, Telemetry::formatName(status.format), status.stalled);
+    }
+  #endif
+}
+
+void handleCardResult(Mapper::MapperError err) {
+  switch(err) {
+    case Mapper::MapperError::OK:
+      break;
+    case Mapper::MapperError::ID_NOT_FOUND:
+      Serial.println(F("Card not found in mapping"));
+      #ifdef OLED
+        oled.trackName("Unknown card");
+      #endif
+      break;
+    case Mapper::MapperError::MAPPING_FILE_NOT_FOUND:
+      fatal.fatal("Mapping error", "Mapping file not found");         
+      break;
+    #ifdef FAIL_ON_FILE_NOT_FOUND  
+      case Mapper::MapperError::REFERENCED_FILE_NOT_FOUND:
+        fatal.fatal("Mapping error", "Data file not found"); 
+        break;
+    #endif              
+    case Mapper::MapperError::LINE_TOO_LONG:
+      fatal.fatal("Mapping error", "Long line/missing newline");         
+      break;
+    default:
+      fatal.fatal("Mapping error", "Malformed line");
+      break;
+  } 
+}
+
+// the player task reads the SD card, the loop never waits for it
+void checkMapping() {
+  player.checkMapping();
+}
+
+void handleMappingResult(Mapper::MapperError err) {
+  if (err != Mapper::MapperError::OK) {
+    Serial.printf("Mapping error %d\n", err);
+    #ifdef OLED
+      oled.trackName("Mapping error");
+    #endif
   }
+}
 
+void checkArena() {
+  arena.check();
+}
+
+void sampleBattery() {
+  battery.sample();
+}
+
+void handlePower() {
+  #ifdef OLED
+    static uint8_t shownPercent = 255;
+    if (battery.percent() != shownPercent) {
+      shownPercent = battery.percent();
+      oled.batteryLevel(shownPercent);
+    }
+  #endif
+
+  power.update();
+}
+
+void handleCard() {
   RFID::CardState cardState = rfid.checkCardState();
   
   switch(cardState) {
     case RFID::CardState::NEW_CARD:
-      {
-        char filename[MAX_FILENAME_STRING_LENGTH];
-        Mapper::MapperError err = mapper.resolveIdToFilename(rfid.currentCard, filename);    
-        switch(err) {
-          case Mapper::MapperError::ID_NOT_FOUND:
-            Serial.println(F("Card not found in mapping"));
-            #ifdef OLED
-              oled.trackName("Unknown card");
-            #endif
-            player.stop();        
-          case Mapper::MapperError::LINE_TOO_LONG:
-            fatal.fatal("Mapping error", "Long line/missing newline");         
-          case Mapper::MapperError::MAPPING_FILE_NOT_FOUND:
-            fatal.fatal("Mapping error", "Mapping file not found");         
-          #ifdef FAIL_ON_FILE_NOT_FOUND  
-            case Mapper::MapperError::REFERENCED_FILE_NOT_FOUND:
-              fatal.fatal("Mapping error", "Data file not found"); 
-          #endif              
-          case OK:
-            player.play(filename);
-        } 
-      }
+      // the mapping is resolved in the player task, see handlePlayerStatus()
+      governor.boost();
+      power.activity();
+      player.playCard(rfid.currentCard);
       break;
     case RFID::CardState::REMOVED_CARD:
       Serial.println("removed card");
+      #ifdef OLED
+        oled.trackName("");
+      #endif
       player.stop();
       break;
     case RFID::CardState::FAULTY_CARD:
       Serial.println("faulty card");
+      #ifdef OLED
+        oled.trackName("");
+      #endif
       player.stop();
       break;
     case RFID::CardState::NO_CHANGE:
       break;
   }
+}
 
-  player.process();
-
+/**
+ * Button events are taken from the queue on every pass, so the loop does not
+ * need a periodic task to wake up for them. A press wakes a light sleep, the
+ * device then stays awake until the debouncer settled.
+ */
+void loop() {
+  scheduler.run();
+  handleButtons();
+  if (governor.idle(buttons.busy() ? 0 : scheduler.microsUntilNextDeadline())) {
+    buttons.poke();
+  }
 }
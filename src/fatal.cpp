@@ -22,7 +22,7 @@
 #include "fatal.h"
 
 #ifdef OLED
-  Fatal::Fatal(Oled oled) : oled(oled) {}
+  Fatal::Fatal(Oled &oled) : oled(oled) {}
 #else
   Fatal::Fatal() {}
 #endif
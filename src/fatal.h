@@ -28,12 +28,12 @@ class Fatal {
 
   private:
     #ifdef OLED
-      Oled oled;
+      Oled &oled;
     #endif
 
   public:
     #ifdef OLED
-      Fatal(Oled oled);
+      Fatal(Oled &oled);
     #else
       Fatal();
     #endif
@@ -0,0 +1,162 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "governor.h"
+#include "wlan.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+
+static const uint8_t wakeButtons[] = {BUTTON1, BUTTON2, BUTTON3};
+
+Governor::Governor(Player &_player) : 
+  player(_player),
+  boostUntil(0),
+  currentMhz(GOVERNOR_FULL_MHZ),
+  rateWindowStart(0),
+  rateWindowBytes(0),
+  bytesPerSecond(0),
+  statsSince(0),
+  sleepMicros(0),
+  sleeps(0),
+  lowClockMicros(0),
+  lowClockSince(0)
+  {}
+
+void Governor::init() {
+  setClock(GOVERNOR_FULL_MHZ);
+  boost();
+  statsSince = micros();
+}
+
+/**
+ * Run at full speed for a while, called on card and button events.
+ */
+void Governor::boost() {
+  boostUntil = millis() + GOVERNOR_BOOST_MS;
+  setClock(GOVERNOR_FULL_MHZ);
+}
+
+void Governor::setClock(uint8_t mhz) {
+  if (mhz == currentMhz) {
+    return;
+  }
+  if (currentMhz != GOVERNOR_FULL_MHZ) {
+    lowClockMicros += micros() - lowClockSince;
+  } else {
+    lowClockSince = micros();
+  }
+  currentMhz = mhz;
+  setCpuFrequencyMhz(mhz);
+}
+
+/**
+ * Bytes per second sent to the decoder, averaged over one second.
+ */
+void Governor::measureRate() {
+  uint32_t elapsed = millis() - rateWindowStart;
+  if (elapsed < 1000) {
+    return;
+  }
+  uint32_t fed = player.status().bytesFed;
+  uint32_t bytes = fed - rateWindowBytes;
+  bytesPerSecond = (uint64_t) bytes * 1000 / elapsed;
+  rateWindowBytes = fed;
+  rateWindowStart = millis();
+}
+
+/**
+ * How long the device may sleep now, 0 if it must stay awake.
+ */
+uint32_t Governor::sleepBudget(uint32_t microsUntilNextTask) {
+  if (!player.isPlaying()) {
+    return microsUntilNextTask;
+  }
+  if (bytesPerSecond == 0 || digitalRead(VS1053_DREQ_PIN)) {
+    return 0;
+  }
+  if (player.bufferFill() < player.bufferSize() * GOVERNOR_SLEEP_FILL / 100) {
+    return 0;
+  }
+  uint32_t fifoMicros = (uint64_t) VS1053_FIFO_BYTES * 1000000 / bytesPerSecond;
+  uint32_t budget = fifoMicros / 2;
+  return budget < microsUntilNextTask ? budget : microsUntilNextTask;
+}
+
+/**
+ * Called after every scheduler pass. Returns true if the device slept.
+ */
+bool Governor::idle(uint32_t microsUntilNextTask) {
+  measureRate();
+
+  if ((int32_t) (millis() - boostUntil) < 0) {
+    return false;
+  }
+
+  // refill at full speed, otherwise the low clock is plenty
+  bool refilling = player.isPlaying() && player.bufferFill() < player.bufferSize() * GOVERNOR_SLEEP_FILL / 100;
+  setClock(refilling ? GOVERNOR_FULL_MHZ : GOVERNOR_LOW_MHZ);
+
+  #ifdef GOVERNOR_LIGHT_SLEEP
+    // light sleep would drop the WiFi connection, modem sleep saves what it can
+    if (wlan.isActive()) {
+      return false;
+    }
+    uint32_t budget = sleepBudget(microsUntilNextTask);
+    if (budget >= GOVERNOR_MIN_SLEEP_US && player.holdForSleep()) {
+      lightSleep(budget);
+      player.releaseAfterSleep();
+      return true;
+    }
+  #endif
+  return false;
+}
+
+void Governor::lightSleep(uint32_t us) {
+  // buttons which are already pressed would wake us right away
+  for (uint8_t i = 0; i < sizeof(wakeButtons); i++) {
+    if (digitalRead(wakeButtons[i])) {
+      gpio_wakeup_enable((gpio_num_t) wakeButtons[i], GPIO_INTR_LOW_LEVEL);
+    } else {
+      gpio_wakeup_disable((gpio_num_t) wakeButtons[i]);
+    }
+  }
+  esp_sleep_enable_gpio_wakeup();
+  esp_sleep_enable_timer_wakeup(us);
+
+  Serial.flush();
+  uint32_t start = micros();
+  esp_light_sleep_start();
+  sleepMicros += micros() - start;
+  sleeps++;
+}
+
+void Governor::printStats() {
+  uint32_t elapsed = micros() - statsSince;
+  uint64_t low = lowClockMicros + (currentMhz != GOVERNOR_FULL_MHZ ? micros() - lowClockSince : 0);
+  Serial.printf("Governor: stream %u bytes/s, %u MHz now\n", bytesPerSecond, currentMhz);
+  Serial.printf("  asleep %u.%u%% in %u sleeps, low clock %u.%u%% of %u ms\n",
+    (uint32_t) (sleepMicros * 100 / elapsed), (uint32_t) (sleepMicros * 1000 / elapsed % 10), sleeps,
+    (uint32_t) (low * 100 / elapsed), (uint32_t) (low * 1000 / elapsed % 10), elapsed / 1000);
+  statsSince = micros();
+  sleepMicros = 0;
+  sleeps = 0;
+  lowClockMicros = 0;
+  lowClockSince = micros();
+}
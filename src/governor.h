@@ -0,0 +1,69 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+#include "player.h"
+
+/**
+ * Lowers the CPU clock and uses light sleep while there is nothing to do.
+ *
+ * While playing, the device only sleeps when the VS1053 FIFO is full (DREQ
+ * low) and the ring buffer is above GOVERNOR_SLEEP_FILL. The sleep is timed
+ * to half of the time the decoder FIFO lasts at the measured stream rate.
+ * DREQ itself is no use as a wake source, it rises as soon as 32 bytes are
+ * free. Sleeps end before a scheduler task would miss its deadline, buttons
+ * wake the device immediately. Light sleep stalls the player task on the
+ * other core as well, so it only starts while the player holds no SPI
+ * transfer, load step or cancel (Player::holdForSleep()).
+ */
+class Governor {
+
+  public:
+    Governor(Player &player);
+    void init();
+    bool idle(uint32_t microsUntilNextTask);
+    void boost();
+    void printStats();
+
+  private:
+    Player &player;
+
+    uint32_t boostUntil;
+    uint8_t currentMhz;
+
+    // stream rate measurement
+    uint32_t rateWindowStart;
+    uint32_t rateWindowBytes;
+    uint32_t bytesPerSecond;
+
+    // statistics
+    uint32_t statsSince;
+    uint64_t sleepMicros;
+    uint32_t sleeps;
+    uint64_t lowClockMicros;
+    uint32_t lowClockSince;
+
+    void setClock(uint8_t mhz);
+    void measureRate();
+    uint32_t sleepBudget(uint32_t microsUntilNextTask);
+    void lightSleep(uint32_t us);
+};
@@ -0,0 +1,154 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "headcache.h"
+#include "arena.h"
+
+HeadCache::HeadCache() :
+  entrySize(0),
+  useCounter(0),
+  recording(NULL),
+  hits(0),
+  misses(0)
+  {
+  for (uint8_t i = 0; i < HEAD_CACHE_ENTRIES; i++) {
+    entries[i].data = NULL;
+    entries[i].valid = false;
+  }
+}
+
+/**
+ * Allocate the cache from the arena, with large entries if it is in PSRAM.
+ * Without any memory the cache stays disabled.
+ */
+void HeadCache::init(bool psram) {
+  uint32_t size = psram ? HEAD_CACHE_PSRAM_BYTES : HEAD_CACHE_BYTES;
+  uint8_t* mem = (uint8_t*) arena.alloc("headcache", size * HEAD_CACHE_ENTRIES);
+  if (mem == NULL) {
+    Serial.println("Head cache disabled, out of memory");
+    return;
+  }
+  for (uint8_t i = 0; i < HEAD_CACHE_ENTRIES; i++) {
+    entries[i].data = mem + i * size;
+  }
+  entrySize = size;
+  Serial.printf("Head cache: %d x %u bytes\n", HEAD_CACHE_ENTRIES, entrySize);
+}
+
+HeadCache::Entry* HeadCache::find(const char* filename, uint32_t size, time_t lastWrite) {
+  for (uint8_t i = 0; i < HEAD_CACHE_ENTRIES; i++) {
+    Entry &entry = entries[i];
+    if (entry.valid && entry.size == size && entry.lastWrite == lastWrite &&
+        strncmp(entry.filename, filename, MAX_FILENAME_LENGTH) == 0) {
+      return &entry;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Copy the cached head of a file into the (empty) ring buffer. filePosition is
+ * set to where reading from SD has to continue.
+ */
+bool HeadCache::restore(const char* filename, uint32_t size, time_t lastWrite, RingBuffer &ringBuffer,
+  uint32_t &filePosition) {
+  Entry* entry = find(filename, size, lastWrite);
+  if (entry == NULL) {
+    misses++;
+    return false;
+  }
+  hits++;
+  entry->lastUsed = ++useCounter;
+
+  uint32_t copied = 0;
+  while (copied < entry->len) {
+    uint32_t len;
+    uint8_t* ptr = ringBuffer.writePtr(len);
+    if (len == 0) {
+      break;
+    }
+    if (len > entry->len - copied) {
+      len = entry->len - copied;
+    }
+    memcpy(ptr, entry->data + copied, len);
+    ringBuffer.commitWrite(len);
+    copied += len;
+  }
+  filePosition = entry->audioStart + copied;
+  return true;
+}
+
+/**
+ * Start recording the head of a file, audioStart is the file position after
+ * any skipped tag.
+ */
+void HeadCache::record(const char* filename, uint32_t size, time_t lastWrite, uint32_t audioStart) {
+  if (entrySize == 0) {
+    return;
+  }
+  Entry* entry = &entries[0];
+  for (uint8_t i = 1; i < HEAD_CACHE_ENTRIES && entry->valid; i++) {
+    if (!entries[i].valid || entries[i].lastUsed < entry->lastUsed) {
+      entry = &entries[i];
+    }
+  }
+  strncpy(entry->filename, filename, MAX_FILENAME_LENGTH);
+  entry->filename[MAX_FILENAME_LENGTH - 1] = 0;
+  entry->size = size;
+  entry->lastWrite = lastWrite;
+  entry->len = 0;
+  entry->audioStart = audioStart;
+  entry->lastUsed = ++useCounter;
+  entry->valid = false;
+  recording = entry;
+}
+
+/**
+ * Called with every block read from SD while recording. The entry becomes
+ * valid when it is full or the file ended.
+ */
+void HeadCache::append(const uint8_t* data, uint32_t len, bool eof) {
+  if (recording == NULL) {
+    return;
+  }
+  if (len > entrySize - recording->len) {
+    len = entrySize - recording->len;
+  }
+  memcpy(recording->data + recording->len, data, len);
+  recording->len += len;
+  if (eof || recording->len == entrySize) {
+    recording->valid = true;
+    recording = NULL;
+  }
+}
+
+// Drop an incomplete entry, e.g. when the card was removed early
+void HeadCache::abort() {
+  recording = NULL;
+}
+
+void HeadCache::printStats() {
+  Serial.printf("Head cache: %u hits, %u misses\n", hits, misses);
+  for (uint8_t i = 0; i < HEAD_CACHE_ENTRIES; i++) {
+    if (entries[i].valid) {
+      Serial.printf("  %s: %u bytes from %u\n", entries[i].filename, entries[i].len, entries[i].audioStart);
+    }
+  }
+}
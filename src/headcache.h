@@ -0,0 +1,68 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+#include "ringbuffer.h"
+
+/**
+ * Keeps the first bytes of audio of the last HEAD_CACHE_ENTRIES tracks in
+ * memory, together with the file position they end at. Re-inserting a
+ * recent card then starts the decoder from memory while the file is read
+ * from that position in the background. Entries are looked up by name, size
+ * and modification time, so a file replaced under the same name is missed.
+ *
+ * Entries are recorded while a track is read from SD and only become valid
+ * once complete, the least recently used one is replaced.
+ */
+class HeadCache {
+
+  public:
+    HeadCache();
+    void init(bool psram);
+    bool restore(const char* filename, uint32_t size, time_t lastWrite, RingBuffer &ringBuffer, uint32_t &filePosition);
+    void record(const char* filename, uint32_t size, time_t lastWrite, uint32_t audioStart);
+    void append(const uint8_t* data, uint32_t len, bool eof);
+    void abort();
+    void printStats();
+
+  private:
+    struct Entry {
+      char filename[MAX_FILENAME_LENGTH];
+      uint32_t size;
+      time_t lastWrite;
+      uint8_t* data;
+      uint32_t len;
+      uint32_t audioStart;
+      uint32_t lastUsed;
+      bool valid;
+    };
+
+    Entry entries[HEAD_CACHE_ENTRIES];
+    uint32_t entrySize;
+    uint32_t useCounter;
+    Entry* recording;
+
+    uint32_t hits;
+    uint32_t misses;
+
+    Entry* find(const char* filename, uint32_t size, time_t lastWrite);
+};
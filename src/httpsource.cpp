@@ -0,0 +1,433 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "httpsource.h"
+
+HttpSource::HttpSource(Client &_client) :
+  position(0),
+  total(0),
+  reconnects(0),
+  firstDataMillis(0),
+  client(_client),
+  state(CLOSED),
+  openedAt(0),
+  port(80),
+  path("/"),
+  redirects(0),
+  attempts(0),
+  retryAt(0),
+  lastData(0),
+  lineLength(0),
+  status(0),
+  contentLength(0),
+  redirected(false),
+  skip(0),
+  live(false),
+  metaInterval(0),
+  untilMeta(0),
+  metaRemaining(0),
+  metaFill(0),
+  newTitle(false)
+  {
+  url[0] = 0;
+  host[0] = 0;
+  streamTitle[0] = 0;
+}
+
+/**
+ * Start reading from a http:// URL, the connection is made by the next
+ * read(). TLS is not supported.
+ */
+bool HttpSource::open(const char* location) {
+  close();
+  if (!parseUrl(location)) {
+    Serial.printf("Unsupported URL %s\n", location);
+    return false;
+  }
+  position = 0;
+  total = 0;
+  reconnects = 0;
+  firstDataMillis = 0;
+  redirects = 0;
+  attempts = 0;
+  live = false;
+  streamTitle[0] = 0;
+  newTitle = false;
+  openedAt = millis();
+  retryAt = openedAt;
+  state = CONNECT;
+  return true;
+}
+
+void HttpSource::close() {
+  client.stop();
+  state = CLOSED;
+}
+
+/**
+ * Split the URL into host, port and path. The URL is copied first, as a
+ * redirect location lives in the line buffer.
+ */
+bool HttpSource::parseUrl(const char* location) {
+  if (strncmp(location, "http://", 7) != 0 || strlen(location) >= MAX_FILENAME_LENGTH) {
+    return false;
+  }
+  strcpy(url, location);
+  const char* start = url + 7;
+  const char* end = start;
+  while (*end && *end != ':' && *end != '/') {
+    end++;
+  }
+  if (end == start || end - start >= HTTP_HOST_LENGTH) {
+    return false;
+  }
+  memcpy(host, start, end - start);
+  host[end - start] = 0;
+  port = 80;
+  if (*end == ':') {
+    port = atoi(end + 1);
+    while (*end && *end != '/') {
+      end++;
+    }
+  }
+  path = *end ? end : "/";
+  return port != 0;
+}
+
+/**
+ * Connect and send the request. A file which broke off is continued with a
+ * range request, a radio stream is not.
+ */
+void HttpSource::connect() {
+  if (!client.connect(host, port)) {
+    Serial.printf("Connecting to %s:%u failed\n", host, port);
+    lost();
+    return;
+  }
+  char request[MAX_FILENAME_LENGTH + HTTP_HOST_LENGTH + 128];
+  int len = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\nHost: %s", path, host);
+  if (port != 80) {
+    len += snprintf(request + len, sizeof(request) - len, ":%u", port);
+  }
+  len += snprintf(request + len, sizeof(request) - len, "\r\nUser-Agent: esp32-audioplayer\r\nIcy-MetaData: 1\r\n");
+  if (position > 0 && !live) {
+    len += snprintf(request + len, sizeof(request) - len, "Range: bytes=%u-\r\n", position);
+  }
+  len += snprintf(request + len, sizeof(request) - len, "\r\n");
+  client.write((const uint8_t*) request, len);
+
+  lineLength = 0;
+  status = 0;
+  contentLength = 0;
+  redirected = false;
+  metaInterval = 0;
+  lastData = millis();
+  state = HEADERS;
+}
+
+/**
+ * The connection broke, timed out or could not be made. Tries again after
+ * HTTP_RECONNECT_MS, doubling with every failed attempt in a row.
+ */
+void HttpSource::lost() {
+  client.stop();
+  if (total > 0 && position >= total) {
+    state = FINISHED;
+    return;
+  }
+  if (attempts >= HTTP_RECONNECT_ATTEMPTS) {
+    Serial.printf("Giving up on %s\n", url);
+    state = FAILED;
+    return;
+  }
+  uint32_t wait = HTTP_RECONNECT_MS << attempts;
+  if (wait > HTTP_RECONNECT_MAX_MS) {
+    wait = HTTP_RECONNECT_MAX_MS;
+  }
+  attempts++;
+  reconnects++;
+  retryAt = millis() + wait;
+  state = CONNECT;
+}
+
+void HttpSource::readHeaders() {
+  while (state == HEADERS && client.available() > 0) {
+    int c = client.read();
+    if (c < 0) {
+      break;
+    }
+    lastData = millis();
+    if (c == '\r') {
+      continue;
+    }
+    if (c != '\n') {
+      // overlong lines are cut, no header of interest is that long
+      if (lineLength < sizeof(line) - 1) {
+        line[lineLength++] = c;
+      }
+      continue;
+    }
+    line[lineLength] = 0;
+    if (lineLength == 0) {
+      endOfHeaders();
+    } else {
+      header();
+    }
+    lineLength = 0;
+  }
+}
+
+static bool headerIs(const char* line, const char* name, const char* &value) {
+  size_t len = strlen(name);
+  if (strncasecmp(line, name, len) != 0) {
+    return false;
+  }
+  value = line + len;
+  while (*value == ' ') {
+    value++;
+  }
+  return true;
+}
+
+/**
+ * One line of the response header, the first one holds the status
+ * ("HTTP/1.1 200 OK" or "ICY 200 OK" of older Shoutcast servers).
+ */
+void HttpSource::header() {
+  const char* value;
+  if (status == 0) {
+    const char* space = strchr(line, ' ');
+    status = space ? atoi(space + 1) : 0;
+    if (status == 0) {
+      status = 999;
+    }
+    if (strncmp(line, "ICY", 3) == 0) {
+      live = true;
+    }
+  } else if (headerIs(line, "content-length:", value)) {
+    contentLength = strtoul(value, NULL, 10);
+  } else if (headerIs(line, "content-range:", value)) {
+    const char* slash = strchr(value, '/');
+    if (slash && slash[1] != '*') {
+      total = strtoul(slash + 1, NULL, 10);
+    }
+  } else if (headerIs(line, "icy-metaint:", value)) {
+    metaInterval = strtoul(value, NULL, 10);
+    live = true;
+  } else if (headerIs(line, "location:", value) && status >= 300 && status < 400) {
+    redirected = parseUrl(value);
+  } else if (strncasecmp(line, "icy-", 4) == 0) {
+    live = true;
+  }
+}
+
+void HttpSource::endOfHeaders() {
+  if (redirected) {
+    client.stop();
+    if (++redirects > HTTP_MAX_REDIRECTS) {
+      Serial.println("Too many redirects");
+      state = FAILED;
+      return;
+    }
+    Serial.printf("Redirected to %s\n", url);
+    retryAt = millis();
+    state = CONNECT;
+    return;
+  }
+
+  if (status == 200) {
+    // a resume answered with the whole file, or a first response
+    skip = live ? 0 : position;
+    total = contentLength;
+  } else if (status == 206) {
+    skip = 0;
+    if (total == 0) {
+      total = position + contentLength;
+    }
+  } else {
+    Serial.printf("HTTP status %u for %s\n", status, url);
+    client.stop();
+    state = FAILED;
+    return;
+  }
+  untilMeta = metaInterval;
+  metaRemaining = 0;
+  state = BODY;
+}
+
+/**
+ * Up to len audio bytes, 0 while connecting or if nothing arrived.
+ */
+uint32_t HttpSource::read(uint8_t* buffer, uint32_t len) {
+  switch (state) {
+    case CONNECT:
+      if ((int32_t) (millis() - retryAt) >= 0) {
+        connect();
+      }
+      return 0;
+
+    case HEADERS:
+      readHeaders();
+      if (state == HEADERS && millis() - lastData > HTTP_STALL_MS) {
+        lost();
+      }
+      return 0;
+
+    case BODY:
+      break;
+
+    default:
+      return 0;
+  }
+
+  int available = client.available();
+  if (available <= 0) {
+    // without a length the server ends a file by closing the connection
+    if (!client.connected() && total == 0 && !live) {
+      client.stop();
+      state = FINISHED;
+      return 0;
+    }
+    if (!client.connected() || millis() - lastData > HTTP_STALL_MS) {
+      Serial.printf("Stream lost at byte %u\n", position);
+      lost();
+    }
+    return 0;
+  }
+  if (len > (uint32_t) available) {
+    len = available;
+  }
+  int read = client.read(buffer, len);
+  if (read <= 0) {
+    return 0;
+  }
+  lastData = millis();
+  attempts = 0;
+  uint32_t audio = strip(buffer, read);
+  if (audio > 0 && position == 0) {
+    firstDataMillis = millis() - openedAt;
+  }
+  position += audio;
+  if (total > 0 && position >= total) {
+    client.stop();
+    state = FINISHED;
+  }
+  return audio;
+}
+
+/**
+ * Remove metadata blocks in place: after every metaInterval audio bytes a
+ * length byte follows, then 16 times as many bytes of metadata. Bytes a
+ * resumed request got again are dropped here as well.
+ */
+uint32_t HttpSource::strip(uint8_t* data, uint32_t len) {
+  if (metaInterval == 0 && skip == 0) {
+    return len;
+  }
+  uint32_t out = 0;
+  uint32_t i = 0;
+  while (i < len) {
+    if (metaInterval == 0 || untilMeta > 0) {
+      uint32_t n = len - i;
+      if (metaInterval > 0 && n > untilMeta) {
+        n = untilMeta;
+      }
+      uint32_t drop = n < skip ? n : skip;
+      skip -= drop;
+      memmove(data + out, data + i + drop, n - drop);
+      out += n - drop;
+      i += n;
+      if (metaInterval > 0) {
+        untilMeta -= n;
+      }
+    } else if (metaRemaining == 0) {
+      metaRemaining = data[i++] * 16;
+      metaFill = 0;
+      if (metaRemaining == 0) {
+        untilMeta = metaInterval;
+      }
+    } else {
+      uint32_t n = len - i;
+      if (n > metaRemaining) {
+        n = metaRemaining;
+      }
+      for (uint32_t j = 0; j < n && metaFill < sizeof(meta) - 1; j++) {
+        meta[metaFill++] = data[i + j];
+      }
+      metaRemaining -= n;
+      i += n;
+      if (metaRemaining == 0) {
+        meta[metaFill] = 0;
+        parseMeta();
+        untilMeta = metaInterval;
+      }
+    }
+  }
+  return out;
+}
+
+// StreamTitle='Artist - Title';StreamUrl='...';
+void HttpSource::parseMeta() {
+  const char* start = strstr(meta, "StreamTitle='");
+  if (start == NULL) {
+    return;
+  }
+  start += 13;
+  const char* end = strstr(start, "';");
+  size_t len = end ? end - start : strlen(start);
+  if (len >= sizeof(streamTitle)) {
+    len = sizeof(streamTitle) - 1;
+  }
+  if (strncmp(streamTitle, start, len) != 0 || streamTitle[len] != 0) {
+    memcpy(streamTitle, start, len);
+    streamTitle[len] = 0;
+    newTitle = true;
+  }
+}
+
+/**
+ * No more data will come: the file was read completely, or the stream
+ * failed for good.
+ */
+bool HttpSource::done() {
+  return state == FINISHED || state == FAILED || state == CLOSED;
+}
+
+bool HttpSource::failed() {
+  return state == FAILED;
+}
+
+bool HttpSource::titleChanged() {
+  bool changed = newTitle;
+  newTitle = false;
+  return changed;
+}
+
+const char* HttpSource::title() {
+  return streamTitle;
+}
+
+void HttpSource::print() {
+  Serial.printf("Stream %s: %u", url, position);
+  if (total > 0) {
+    Serial.printf(" of %u", total);
+  }
+  Serial.printf(" bytes, first data after %u ms, %u reconnects\n", firstDataMillis, reconnects);
+}
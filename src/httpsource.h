@@ -0,0 +1,102 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "Client.h"
+#include "config.h"
+
+/**
+ * Audio from an HTTP server or an Icecast/Shoutcast stream. read() drives
+ * the connection step by step and returns audio bytes only, ICY metadata is
+ * cut out and the stream title kept. A lost connection is opened again
+ * after a growing delay: files continue with a range request where they
+ * broke off, live streams continue at the live position.
+ *
+ * Works on any Arduino Client, so it can be run on the host as well (see
+ * bench/stream.sh).
+ */
+class HttpSource {
+
+  public:
+    HttpSource(Client &client);
+    bool open(const char* url);
+    void close();
+    uint32_t read(uint8_t* buffer, uint32_t len);
+    bool done();
+    bool failed();
+    bool titleChanged();
+    const char* title();
+    void print();
+
+    uint32_t position;          // audio bytes delivered
+    uint32_t total;             // length of a file, 0 for live streams
+    uint32_t reconnects;
+    uint32_t firstDataMillis;   // from open() to the first audio byte
+
+  private:
+    enum State {CLOSED, CONNECT, HEADERS, BODY, FINISHED, FAILED};
+
+    Client &client;
+    State state;
+    uint32_t openedAt;
+
+    // where to connect, path points into url
+    char url[MAX_FILENAME_LENGTH];
+    char host[HTTP_HOST_LENGTH];
+    uint16_t port;
+    const char* path;
+    uint8_t redirects;
+    bool parseUrl(const char* location);
+
+    // reconnects, attempts counts the failed ones in a row
+    uint8_t attempts;
+    uint32_t retryAt;
+    uint32_t lastData;
+    void connect();
+    void lost();
+
+    // response headers, read a line at a time
+    char line[HTTP_LINE_LENGTH];
+    uint16_t lineLength;
+    uint16_t status;
+    uint32_t contentLength;
+    bool redirected;
+    void readHeaders();
+    void header();
+    void endOfHeaders();
+
+    // bytes to drop when a resume was answered with the whole file
+    uint32_t skip;
+
+    // sent icy- headers, a radio stream is continued live, not resumed
+    bool live;
+
+    // ICY metadata, metaRemaining is the rest of the current block
+    uint32_t metaInterval;
+    uint32_t untilMeta;
+    uint16_t metaRemaining;
+    char meta[HTTP_TITLE_LENGTH + 16];
+    uint16_t metaFill;
+    char streamTitle[HTTP_TITLE_LENGTH];
+    bool newTitle;
+    uint32_t strip(uint8_t* data, uint32_t len);
+    void parseMeta();
+};
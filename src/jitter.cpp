@@ -0,0 +1,92 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "jitter.h"
+
+JitterBuffer::JitterBuffer() :
+  target(JITTER_MIN_BYTES),
+  underruns(0),
+  startupMillis(0),
+  maxTarget(JITTER_MIN_BYTES),
+  buffering(true),
+  started(false),
+  startedAt(0),
+  lastChange(0)
+  {}
+
+/**
+ * New stream. The target may grow up to most of the buffer, keeping some
+ * room for data arriving while the decoder is fed.
+ */
+void JitterBuffer::begin(uint32_t now, uint32_t capacity) {
+  maxTarget = capacity / 10 * 9;
+  if (maxTarget > JITTER_MAX_BYTES) {
+    maxTarget = JITTER_MAX_BYTES;
+  }
+  target = JITTER_MIN_BYTES < maxTarget ? JITTER_MIN_BYTES : maxTarget;
+  underruns = 0;
+  startupMillis = 0;
+  buffering = true;
+  started = false;
+  startedAt = now;
+  lastChange = now;
+}
+
+/**
+ * Called with the current fill before feeding, returns whether the decoder
+ * may be fed. At the end of the source the rest is always played.
+ */
+bool JitterBuffer::update(uint32_t fill, bool sourceDone, uint32_t now) {
+  if (buffering) {
+    if (fill < target && !sourceDone) {
+      return false;
+    }
+    buffering = false;
+    if (!started) {
+      started = true;
+      startupMillis = now - startedAt;
+    }
+    return true;
+  }
+
+  if (fill == 0 && !sourceDone) {
+    underruns++;
+    buffering = true;
+    target += target / 2;
+    if (target > maxTarget) {
+      target = maxTarget;
+    }
+    lastChange = now;
+    return false;
+  }
+
+  if (now - lastChange >= JITTER_SHRINK_MS && target > JITTER_MIN_BYTES) {
+    target -= target / 8;
+    if (target < JITTER_MIN_BYTES) {
+      target = JITTER_MIN_BYTES;
+    }
+    lastChange = now;
+  }
+  return true;
+}
+
+void JitterBuffer::print() {
+  Serial.printf("Jitter buffer: target %u bytes, %u underruns, started after %u ms\n", target, underruns, startupMillis);
+}
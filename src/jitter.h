@@ -0,0 +1,50 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+
+/**
+ * Decides when buffered network audio may go to the decoder. Playback starts
+ * once the buffer holds the target fill. Running dry while the source still
+ * delivers is an underrun: feeding pauses until the target is reached again,
+ * which is raised for the rest of the stream. After a quiet period the
+ * target is lowered step by step again.
+ */
+class JitterBuffer {
+
+  public:
+    JitterBuffer();
+    void begin(uint32_t now, uint32_t capacity);
+    bool update(uint32_t fill, bool sourceDone, uint32_t now);
+    void print();
+
+    uint32_t target;
+    uint32_t underruns;
+    uint32_t startupMillis;     // from begin() until feeding started
+
+  private:
+    uint32_t maxTarget;
+    bool buffering;
+    bool started;
+    uint32_t startedAt;
+    uint32_t lastChange;
+};
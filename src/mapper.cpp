@@ -22,9 +22,41 @@
 #include "config.h"
 #include "FS.h"
 #include "SD.h"
+#include "SPIFFS.h"
+#include "trace.h"
+#include "binlog.h"
+#include "arena.h"
 
+Mapper::Mapper() : seenSize(0), seenTime(0), hashes(NULL), capacity(0) {}
+
+/**
+ * Take the buffer for the validation cache from the arena and check the
+ * mapping file. Without the buffer every check reads the whole file.
+ */
 Mapper::MapperError Mapper::init() {
-    return checkMappingFile();
+  if (hashes == NULL) {
+    uint32_t lines = arena.inPsram() ? MAPPING_CACHE_PSRAM_LINES : MAPPING_CACHE_LINES;
+    hashes = (uint32_t*) arena.alloc("mapper", lines * sizeof(uint32_t));
+    capacity = hashes != NULL ? lines : 0;
+  }
+  return checkMappingFile();
+}
+
+// check again after an edit, init() must have been called before
+Mapper::MapperError Mapper::check() {
+  return checkMappingFile();
+}
+
+/**
+ * Check whether the mapping file was edited (or removed) since the last check,
+ * only opens the file.
+ */
+bool Mapper::changed() {
+  File mappingFile = SD.open(MAPPING_FILE, FILE_READ);
+  if (!mappingFile) {
+    return seenSize != 0 || seenTime != 0;
+  }
+  return mappingFile.size() != seenSize || (uint32_t) mappingFile.getLastWrite() != seenTime;
 }
 
 /**
@@ -42,12 +74,12 @@ Mapper::MapperError Mapper::resolveIdToFilename(byte id[4], char filename[MAX_FI
   char id_string[ID_STRING_LENGTH];
   uid_to_string(id, id_string);
 
-  Serial.print("ID string: ");
-  Serial.println(id_string);
+  LOG_INFO(LOG_CARD_ID, ((uint32_t) id[0] << 24) | ((uint32_t) id[1] << 16) | ((uint32_t) id[2] << 8) | id[3]);
 
   char line[MAX_MAPPING_LINE_STRING_LENGTH];
-  size_t n;
-  while ((n = readLine(line, &mappingFile)) > 0) {
+  uint16_t lineNumber = 0;
+  while (readLine(line, &mappingFile) > 0) {
+    lineNumber++;
     
     char found_id[ID_STRING_LENGTH];
     MapperError err = extractIdFromLine(found_id, line);
@@ -56,12 +88,14 @@ Mapper::MapperError Mapper::resolveIdToFilename(byte id[4], char filename[MAX_FI
     }
     
     if (strncmp(found_id, id_string, 8) == 0) {
-      strncpy(filename, &(line[ID_STRING_LENGTH]), MAX_FILENAME_STRING_LENGTH);
+      // an over-long line fails the check, cut it all the same
+      strncpy(filename, &(line[ID_STRING_LENGTH]), MAX_FILENAME_STRING_LENGTH - 1);
+      filename[MAX_FILENAME_STRING_LENGTH - 1] = 0;
+      latencyTrace.event(TRACE_MAPPING_RESOLVED);
       return OK;
     }
-    
-    Serial.println(line);
 
+    LOG_DEBUG(LOG_MAPPING_SKIPPED, lineNumber);
   }
 
   filename[0] = 0;
@@ -84,6 +118,7 @@ Mapper::MapperError Mapper::extractIdFromLine(char found_id[ID_STRING_LENGTH], c
     found_id[i] = line[i];
   }
   found_id[8] = 0;
+  return MapperError::OK;
 }
 
 // copy id to char array
@@ -106,35 +141,142 @@ uint16_t Mapper::readLine(char str[MAX_MAPPING_LINE_STRING_LENGTH], File *stream
     }
     str[i++] = ch;
   }
+  // the rest of an over-long line is dropped, it must not pass for a line of its own
+  if (i == MAX_MAPPING_LINE_STRING_LENGTH - 1) {
+    int16_t ch;
+    do {
+      ch = stream->read();
+    } while (ch >= 0 && ch != 10);
+  }
   return i; 
 }
 
+// FNV-1a, identifies a line in the validation cache
+static uint32_t lineHash(const char* line) {
+  uint32_t hash = 2166136261UL;
+  while (*line) {
+    hash = (hash ^ (uint8_t) *line++) * 16777619UL;
+  }
+  return hash;
+}
+
+static int compareHash(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*) a;
+  uint32_t y = *(const uint32_t*) b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
 /**
- * Check syntax of mapping file and existence of linked files
+ * Check syntax of mapping file and existence of linked files. Lines which
+ * passed before are skipped, their hashes are kept in SPIFFS along with size
+ * and modification time of the mapping file. If these match, nothing is read.
  */
 Mapper::MapperError Mapper::checkMappingFile() {
-  Serial.println("Checking mapping file...");
   File mappingFile = SD.open(MAPPING_FILE, FILE_READ);
   if (!mappingFile) {
+    seenSize = 0;
+    seenTime = 0;
     return MapperError::MAPPING_FILE_NOT_FOUND;    
   }
-  Serial.println("Found mapping file...");
+  seenSize = mappingFile.size();
+  seenTime = mappingFile.getLastWrite();
+
+  uint32_t knownCount;
+  bool upToDate;
+  loadValidated(knownCount, upToDate);
+  if (upToDate) {
+    Serial.printf("Mapping file unchanged, %u lines validated before\n", knownCount);
+    return MapperError::OK;
+  }
+  Serial.println("Checking mapping file...");
+
+  // without known lines the buffer collects the hashes right away
+  bool collecting = knownCount == 0;
+  uint32_t count = 0;
+  uint32_t reused = 0;
+  MapperError result = MapperError::OK;
 
   char line[MAX_MAPPING_LINE_STRING_LENGTH];
-  
+  uint16_t lineNumber = 0;
   while ((readLine(line, &mappingFile)) > 0) {    
-    Serial.printf("Line contents: %s\n", line);
-    MapperError err = checkMappingLine(line);
-    if (err != MapperError::OK) {
-      return err;  
-    }    
+    lineNumber++;
+    uint32_t hash = lineHash(line);
+    if (knownCount && bsearch(&hash, hashes, knownCount, sizeof(uint32_t), compareHash) != NULL) {
+      reused++;
+    } else {
+      MapperError err = checkMappingLine(line);
+      if (err != MapperError::OK) {
+        Serial.printf("Mapping line %u: %s\n", lineNumber, line);
+        result = err;
+        break;
+      }
+    }
+    LOG_DEBUG(LOG_MAPPING_LINE_OK, lineNumber);
+    if (collecting && count < capacity) {
+      hashes[count++] = hash;
+    }
   }
 
-  Serial.println("Mapping file looks OK");
+  if (result == MapperError::OK) {
+    Serial.printf("Mapping file looks OK, %u of %u lines validated before\n", reused, lineNumber);
+    if (lineNumber > capacity) {
+      // too long to remember the lines, an unchanged file is still skipped
+      count = 0;
+    } else if (!collecting) {
+      // the known hashes were needed up to the last line, read it again
+      mappingFile.seek(0);
+      count = 0;
+      while (readLine(line, &mappingFile) > 0) {
+        hashes[count++] = lineHash(line);
+      }
+    }
+    saveValidated(count);
+  }
+  return result;
+}
 
-  return MapperError::OK;
+/**
+ * Read the validation cache. upToDate is set if it belongs to the current
+ * mapping file, otherwise the sorted hashes of the validated lines are
+ * loaded into the buffer, if they fit.
+ */
+void Mapper::loadValidated(uint32_t &count, bool &upToDate) {
+  count = 0;
+  upToDate = false;
+  File cache = SPIFFS.open(MAPPING_CACHE_FILE, FILE_READ);
+  if (!cache) {
+    return;
+  }
+  uint32_t header[4];
+  if (cache.read((uint8_t*) header, sizeof(header)) != sizeof(header) || header[0] != MAPPING_CACHE_VERSION) {
+    return;
+  }
+  if (header[1] == seenSize && header[2] == seenTime) {
+    upToDate = true;
+    count = header[3];
+    return;
+  }
+  if (header[3] > capacity || cache.read((uint8_t*) hashes, header[3] * sizeof(uint32_t)) != header[3] * sizeof(uint32_t)) {
+    return;
+  }
+  count = header[3];
 }
 
+void Mapper::saveValidated(uint32_t count) {
+  if (count) {
+    qsort(hashes, count, sizeof(uint32_t), compareHash);
+  }
+  File cache = SPIFFS.open(MAPPING_CACHE_FILE, FILE_WRITE);
+  if (!cache) {
+    return;
+  }
+  uint32_t header[4] = {MAPPING_CACHE_VERSION, seenSize, seenTime, count};
+  cache.write((uint8_t*) header, sizeof(header));
+  if (count) {
+    cache.write((uint8_t*) hashes, count * sizeof(uint32_t));
+  }
+  cache.close();
+}
 
 /**
  * Check syntax of mapping line and existence of linked file
@@ -164,8 +306,11 @@ Mapper::MapperError Mapper::checkMappingLine(char* line) {
     return MapperError::MALFORMED_LINE_SYNTAX;
   }
 
-  // check file entry
+  // check file entry, it has to fit the filename buffer with terminator
   char* filename = line + ID_STRING_LENGTH;
+  if (strlen(filename) >= MAX_FILENAME_STRING_LENGTH - 1) {
+    return MapperError::LINE_TOO_LONG;
+  }
 
   // filename must start with a slash or a hash
   if (filename[0] != '/' && filename[0] != '#') {
@@ -173,7 +318,7 @@ Mapper::MapperError Mapper::checkMappingLine(char* line) {
   }
 
   if (filename[0] == '#') {
-    // special card, everything ok
+    // special card or network stream ("#http://host/path"), everything ok
     return MapperError::OK;
   } 
   
@@ -185,9 +330,8 @@ Mapper::MapperError Mapper::checkMappingLine(char* line) {
       return MapperError::REFERENCED_FILE_NOT_FOUND;
     }
     dataFile.close();  
-
-    return MapperError::OK;
   #endif
 
+  return MapperError::OK;
 
 }
@@ -26,8 +26,10 @@
 #include "SD.h"
 
 #define MAPPING_FILE                    "/mapping.txt"
+#define MAPPING_CACHE_FILE              "/mapping.meta"                   // in SPIFFS
+#define MAPPING_CACHE_VERSION           1
 #define ID_STRING_LENGTH                (ID_BYTE_ARRAY_LENGTH * 2 + 1)    // with zero terminator
-#define MAX_FILENAME_STRING_LENGTH      (50 + 1)                          // with zero terminator
+#define MAX_FILENAME_STRING_LENGTH      MAX_FILENAME_LENGTH               // with zero terminator, also holds stream URLs
 #define MAX_MAPPING_LINE_STRING_LENGTH  (MAX_FILENAME_STRING_LENGTH + ID_STRING_LENGTH)    
 
 class Mapper {
@@ -83,10 +85,23 @@ class Mapper {
       MALFORMED_FILE_NAME  
     };
         
+    Mapper();
     MapperError init();   
+    MapperError check();
+    bool changed();
     MapperError resolveIdToFilename(byte id[ID_BYTE_ARRAY_LENGTH], char filename[MAX_FILENAME_STRING_LENGTH]); 
     
   private:
+    // size and modification time of the mapping file at the last check
+    uint32_t seenSize;
+    uint32_t seenTime;
+
+    // hashes of validated lines, taken from the arena by init()
+    uint32_t* hashes;
+    uint32_t capacity;
+    void loadValidated(uint32_t &count, bool &upToDate);
+    void saveValidated(uint32_t count);
+
     void uid_to_string(byte *uid, char output[9]);
     MapperError extractIdFromLine(char found_id[ID_STRING_LENGTH], char line[MAX_MAPPING_LINE_STRING_LENGTH]);
     MapperError checkMappingFile();
@@ -25,7 +25,8 @@
 
 Oled::Oled(uint8_t _i2cAddress) : 
   i2cAddress(_i2cAddress),
-  ssd1306(-1)
+  ssd1306(-1),
+  dirty(false)
   {}
 
 void Oled::init() {
@@ -37,7 +38,7 @@ void Oled::init() {
 
 void Oled::clear() {
   ssd1306.clearDisplay();
-  ssd1306.display();
+  dirty = true;
 }
 
 void Oled::trackName(char* trackName) {
@@ -46,11 +47,23 @@ void Oled::trackName(char* trackName) {
   ssd1306.setTextSize(1);
   ssd1306.setCursor(0,0);
   ssd1306.printf("%s", trackName);
-  ssd1306.display();  
+  dirty = true;
+}
+
+/**
+ * Elapsed time, format and bit rate below the track name
+ */
+void Oled::playbackInfo(uint16_t seconds, uint16_t kbps, const char* format, bool stalled) {
+  ssd1306.fillRect(0,11,127,9,BLACK); 
+  ssd1306.setTextColor(1);
+  ssd1306.setTextSize(1);
+  ssd1306.setCursor(0,11);
+  ssd1306.printf("%u:%02u %s %uk%s", seconds / 60, seconds % 60, format, kbps, stalled ? " !" : "");
+  dirty = true;
 }
 
 void Oled::cardId(byte *card, uint8_t len) {  
-  ssd1306.fillRect(0,21,127,40,BLACK); 
+  ssd1306.fillRect(0,21,106,11,BLACK);   // up to the battery symbol
   ssd1306.setTextColor(1);
   ssd1306.setTextSize(1);
   ssd1306.setCursor(0,21);
@@ -58,7 +71,30 @@ void Oled::cardId(byte *card, uint8_t len) {
     ssd1306.print(card[i] < 0x10 ? " 0" : " ");
     ssd1306.print(card[i], HEX);
   }
-  ssd1306.display();
+  dirty = true;
+}
+
+/**
+ * Send the frame buffer to the display if anything was drawn since the last
+ * update. Drawing functions only touch the frame buffer, so this caps the
+ * I²C traffic to the rate update() is called at.
+ */
+void Oled::update() {
+  if (dirty) {
+    dirty = false;
+    ssd1306.display();
+  }
+}
+
+/**
+ * Switch the panel off resp. on again, the frame buffer is kept.
+ */
+void Oled::sleep() {
+  ssd1306.ssd1306_command(SSD1306_DISPLAYOFF);
+}
+
+void Oled::wake() {
+  ssd1306.ssd1306_command(SSD1306_DISPLAYON);
 }
 
 /**
@@ -95,7 +131,7 @@ void Oled::loadingBar(uint8_t percent) {
    ssd1306.fillRect(9,10,108,13,1);
    ssd1306.fillRect(12,12,102,9,0);
    ssd1306.fillRect(13,13,percent,7,1);
-   ssd1306.display();  
+   dirty = true;
 }
 
 /**
@@ -105,6 +141,18 @@ void Oled::volumeBar(uint8_t percent) {
   loadingBar(percent);
 }
 
+/**
+ * Battery symbol with fill level in the lower right corner
+ */
+void Oled::batteryLevel(uint8_t percent) {
+  ssd1306.fillRect(106, 24, 22, 8, BLACK);
+  ssd1306.fillRect(106, 24, 20, 7, WHITE);
+  ssd1306.fillRect(107, 25, 18, 5, BLACK);
+  ssd1306.fillRect(126, 26, 2, 3, WHITE);
+  ssd1306.fillRect(108, 26, percent * 16 / 100, 3, WHITE);
+  dirty = true;
+}
+
 void Oled::buttons(char buttons) {
   for(int i=0; i<4; i++) {    
     ssd1306.fillRect(i * 5, 25, 4, 4, 1);
@@ -112,6 +160,6 @@ void Oled::buttons(char buttons) {
       ssd1306.fillRect(i * 5 + 1, 26, 2, 2, 0);
     }
   }
-  ssd1306.display();
+  dirty = true;
 }
 #endif
\ No newline at end of file
@@ -28,15 +28,22 @@ class Oled {
   private:
     uint8_t i2cAddress;
     Adafruit_SSD1306 ssd1306;
+    bool dirty;
 
   public:
     Oled(uint8_t i2cAddress);
+    Oled(const Oled&) = delete;   // a copy would have its own framebuffer
     void init();
     void clear();
+    void update();
+    void sleep();
+    void wake();
     void trackName(char* trackName);
+    void playbackInfo(uint16_t seconds, uint16_t kbps, const char* format, bool stalled);
     void buttons(char buttons);
     void cardId(byte *card, uint8_t len);
     void fatalErrorMessage(char* error, char* info);
     void loadingBar(uint8_t percent);
     void volumeBar(uint8_t percent);
+    void batteryLevel(uint8_t percent);
 };
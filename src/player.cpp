@@ -21,9 +21,22 @@
 #include "config.h"
 #include "player.h"
 #include "VS1053.h"
+#include "trace.h"
+#include "binlog.h"
+#include "rambudget.h"
+#include "arena.h"
+#include "spitrace.h"
+#include "plugins.h"
+#include "tags.h"
+#include "wlan.h"
 #include <SD.h>
+#include <SPIFFS.h>
 
-  Player::Player(Fatal fatal, Oled oled, VS1053 vs1053) : 
+#ifdef OLED
+  Player::Player(Fatal &fatal, Oled &oled, VS1053 &vs1053, Mapper &mapper) : 
+#else
+  Player::Player(Fatal &fatal, VS1053 &vs1053, Mapper &mapper) : 
+#endif
       state(STOPPED), 
       oldState(INITIALIZING),
       fatal(fatal),     
@@ -31,180 +44,1033 @@
         oled(oled),
       #endif
       vs1053(vs1053),
-      ringBuffer(20000),
+      mapper(mapper),
+      ringBuffer(),
+      headCache(),
+      telemetry(),
       dataFile(),
+      fileSystem(&SD),
       currentVolume(65),      
-      lastTime(0),
-      idleTime(0) {}
+      directory(),
+      directoryIndex(0),
+      trackCount(0),
+      position(0),
+      failedTracks(0),
+      shuffleMode(false),
+      repeatMode(false),
+      shuffle(),
+      firstByteSent(true),
+      awaitingDecoder(false),
+      lastDecoderPoll(0),
+      refilling(false),
+      bufferInPsram(false),
+      sdActiveMicros(0),
+      sdBytesRead(0),
+      sdBursts(0),
+      statsSince(0),
+      seekPending(false),
+      seekPosition(0),
+      layoutCache(),
+      segmentIndex(0),
+      prefixSent(0),
+      lastTelemetryPoll(0),
+      loading(LOAD_IDLE),
+      loadFile(),
+      loadPosition(0),
+      loadIndex(0),
+      playWhenLoaded(false),
+      maxIterationMicros(0),
+      #ifdef HTTP_STREAMS
+        streamClient(),
+        stream(streamClient),
+        jitter(),
+        streaming(false),
+        streamRequested(0),
+      #endif
+      commands(NULL),
+      statusMux(portMUX_INITIALIZER_UNLOCKED),
+      cardSequence(0),
+      cardResult(Mapper::OK),
+      mappingSequence(0),
+      mappingResult(Mapper::OK),
+      bytesFed(0),
+      busy(NULL),
+      idle(false) {}
 
+/**
+ * Does not need the SD card, system sounds can be played right afterwards.
+ */
 void Player::init() {
   // Initialize audio decoder
   vs1053.begin();
+  Plugins(vs1053).load();
+
+  // a large read-ahead buffer if the arena is in PSRAM
+  bufferInPsram = arena.inPsram();
+  if (!ringBuffer.allocate(bufferInPsram ? RINGBUFFER_PSRAM_SIZE : RINGBUFFER_SIZE)) {
+    fatal.fatal("Out of memory", "Read-ahead buffer");
+  }
+  Serial.printf("Read-ahead buffer: %u bytes in %s\n", ringBuffer.capacity(), bufferInPsram ? "PSRAM" : "internal RAM");
+  headCache.init(bufferInPsram);
+  statsSince = millis();
   #ifndef FAST_BOOT
     vs1053.printDetails();
   #endif
+  publish();
 }
 
-void Player::play(char* filename) {
-
-  Serial.printf("Play: %s\n", filename);
+/**
+ * Start the player task, from now on only the task touches the decoder.
+ */
+void Player::start() {
+  commands = xQueueCreate(PLAYER_QUEUE_LENGTH, sizeof(Command));
+  busy = xSemaphoreCreateMutex();
+  TaskHandle_t handle;
+  xTaskCreatePinnedToCore(task, "player", PLAYER_TASK_STACK, this, PLAYER_TASK_PRIORITY, &handle, PLAYER_TASK_CORE);
+  ramBudget.task("player", handle, PLAYER_TASK_STACK);
+}
 
-  clearPlaylist();
+void Player::task(void* player) {
+  ((Player*) player)->run();
+}
 
-  dataFile = SD.open(filename, FILE_READ);
-  if (!dataFile) {
-    Serial.printf("Error opening file %s\n", filename);
-    dataFile = SD.open("/error.mp3", FILE_READ);
-    if (!dataFile) {
-      stop();
-      return;
+/**
+ * Wait up to one tick for a command, so SD reads and decoder feeding continue
+ * in between and commands are handled at once. busy is only given up for
+ * that wait, no SPI transfer is running then.
+ */
+void Player::run() {
+  Command command;
+  xSemaphoreTake(busy, portMAX_DELAY);
+  while (true) {
+    xSemaphoreGive(busy);
+    bool received = xQueueReceive(commands, &command, 1) == pdTRUE;
+    xSemaphoreTake(busy, portMAX_DELAY);
+    uint32_t start = micros();
+    if (received) {
+      handleCommand(command);
+    }
+    process();
+    pollTelemetry();
+    #ifdef HTTP_STREAMS
+      wlan.update();
+    #endif
+    publish();
+    // a cancel or a load continues in the next iteration, it must not stall
+    idle = state != STOPPING && (loading == LOAD_IDLE || loading == LOAD_READY);
+    uint32_t duration = micros() - start;
+    if (duration > maxIterationMicros) {
+      maxIterationMicros = duration;
     }
   }
+}
+
+/**
+ * Commands open files (mapping, system sounds, SPIFFS caches) and print
+ * longer lines, the framework allocates for both.
+ */
+void Player::handleCommand(Command &command) {
+  MallocAllowed opening;
+  switch (command.type) {
+    case CMD_PLAY:
+      playFile(command.filename);
+      break;
+    case CMD_PLAY_CARD:
+      resolveCard(command.card);
+      break;
+    case CMD_PLAY_SYSTEM_SOUND:
+      playSystemSoundFile(command.filename);
+      break;
+    case CMD_STOP:
+      stopPlayback();
+      break;
+    case CMD_NEXT:
+      if (state == PLAYING) {
+        nextTrack();
+      }
+      break;
+    case CMD_VOLUME:
+      setVolume(currentVolume + command.value);
+      break;
+    case CMD_SEEK:
+      seekBy(command.value);
+      break;
+    case CMD_PRINT_STATS:
+      printStats();
+      break;
+    case CMD_PRINT_TELEMETRY:
+      telemetry.print();
+      break;
+    case CMD_MODE:
+      changeMode();
+      break;
+    case CMD_CHECK_MAPPING:
+      revalidateMapping();
+      break;
+  }
+}
+
+bool Player::post(Command &command) {
+  if (commands == NULL || xQueueSend(commands, &command, 0) != pdTRUE) {
+    Serial.printf("Player command %d dropped\n", command.type);
+    return false;
+  }
+  return true;
+}
+
+bool Player::post(CommandType type, int16_t value) {
+  Command command;
+  command.type = type;
+  command.value = value;
+  return post(command);
+}
 
-  if (dataFile.isDirectory()) {
-    // read directory into playlist
+bool Player::play(const char* filename) {
+  Command command;
+  command.type = CMD_PLAY;
+  strncpy(command.filename, filename, MAX_FILENAME_LENGTH);
+  command.filename[MAX_FILENAME_LENGTH - 1] = 0;
+  return post(command);
+}
+
+/**
+ * Resolve a card id through the mapping and play the result, the outcome is
+ * published in the status.
+ */
+bool Player::playCard(const byte card[ID_BYTE_ARRAY_LENGTH]) {
+  Command command;
+  command.type = CMD_PLAY_CARD;
+  memcpy(command.card, card, ID_BYTE_ARRAY_LENGTH);
+  return post(command);
+}
+
+bool Player::playSystemSound(const char* filename) {
+  Command command;
+  command.type = CMD_PLAY_SYSTEM_SOUND;
+  strncpy(command.filename, filename, MAX_FILENAME_LENGTH);
+  command.filename[MAX_FILENAME_LENGTH - 1] = 0;
+  return post(command);
+}
+
+bool Player::stop() {
+  return post(CMD_STOP);
+}
+
+bool Player::next() {
+  return post(CMD_NEXT);
+}
+
+/**
+ * Jump forward or back by the given number of seconds, MP3 only.
+ */
+bool Player::seek(int16_t seconds) {
+  return post(CMD_SEEK, seconds);
+}
+
+bool Player::increaseVolume() {
+  return post(CMD_VOLUME, 1);
+}
+
+bool Player::decreaseVolume() {
+  return post(CMD_VOLUME, -1);
+}
+
+bool Player::requestStats() {
+  return post(CMD_PRINT_STATS);
+}
+
+bool Player::requestTelemetry() {
+  return post(CMD_PRINT_TELEMETRY);
+}
+
+/**
+ * Next play mode: in order, shuffle, repeat, shuffle and repeat.
+ */
+bool Player::cycleMode() {
+  return post(CMD_MODE);
+}
+
+/**
+ * Pick up edits of the mapping file without a reboot. The player task is the
+ * only one using the mapper, so the file is checked here as well.
+ */
+bool Player::checkMapping() {
+  return post(CMD_CHECK_MAPPING);
+}
+
+// only changed lines are validated again, errors are published, playback goes on
+void Player::revalidateMapping() {
+  if (!mapper.changed()) {
+    return;
+  }
+  Serial.println("Mapping file changed");
+  mappingResult = mapper.check();
+  mappingSequence++;
+}
+
+void Player::resolveCard(byte card[ID_BYTE_ARRAY_LENGTH]) {
+  char filename[MAX_FILENAME_STRING_LENGTH];
+  cardResult = mapper.resolveIdToFilename(card, filename);
+  cardSequence++;
+  switch (cardResult) {
+    case Mapper::OK:
+      playFile(filename);
+      break;
+    case Mapper::ID_NOT_FOUND:
+      stopPlayback();
+      break;
+    default:
+      playSystemSoundFile(SYSTEM_SOUND_ERROR);
+      break;
+  }
+}
 
-    Serial.printf("%s is a directory, creating playlist...\n", filename);
-    clearPlaylist();
+/**
+ * Start playing a file or directory from SD. Only the playlist is reset here,
+ * opening and scanning are done step by step by loadStep(), the buffered
+ * audio of the previous track keeps playing meanwhile.
+ */
+void Player::playFile(const char* filename) {
 
-    File file = dataFile.openNextFile();    
-    while (file && playlistLen+1 < MAX_PLAYLIST_LENGTH) {
-      if(!file.isDirectory()){
-        Serial.printf("Track %02d: %s\n", playlistLen, file.name());
-        addPlaylistEntry((char*) file.name());
-      }   
-      file = dataFile.openNextFile();
+  #ifdef HTTP_STREAMS
+    if (strncmp(filename, "#http://", 8) == 0) {
+      playStream(filename + 1);
+      return;
     }
+    closeStream();
+  #endif
 
-    Serial.printf("Playlist has %d items.\n", playlistLen);
+  Serial.printf("Play: %s\n", filename);
 
-  } else {
-    addPlaylistEntry(filename);
-  } 
+  cancelLoad();
+  clearPlaylist();
+  fileSystem = &SD;
+  strncpy(playlistName, filename, MAX_FILENAME_LENGTH);
+  playlistName[MAX_FILENAME_LENGTH - 1] = 0;
+
+  // stop reading the previous track, what is buffered plays out
+  dataFile.close();
+  refilling = false;
+  seekPending = false;
+  headCache.abort();
+  loading = LOAD_OPEN;
+}
+
+/**
+ * One bounded step of loading: opening the file, counting up to
+ * PLAYER_SCAN_PER_STEP directory entries or going through as many entries on
+ * the way to the next track. Every opened file and directory entry allocates
+ * in the framework.
+ */
+void Player::loadStep() {
+  MallocAllowed opening;
+  switch (loading) {
+
+    case LOAD_OPEN:
+      loadFile = SD.open(playlistName, FILE_READ);
+      if (!loadFile) {
+        Serial.printf("Error opening file %s\n", playlistName);
+        cancelLoad();
+        playSystemSoundFile(SYSTEM_SOUND_ERROR);
+        return;
+      }
+      if (loadFile.isDirectory()) {
+        Serial.printf("%s is a directory, counting tracks...\n", playlistName);
+        directory = loadFile;
+        loadFile = File();
+        directoryIndex = 0;
+        trackCount = 0;
+        loading = LOAD_SCAN;
+      } else {
+        // keep the file open for playNextFile()
+        trackCount = 1;
+        strncpy(loadName, playlistName, MAX_FILENAME_LENGTH);
+        loadPosition = 0;
+        loading = LOAD_TRACK;
+      }
+      break;
+
+    case LOAD_SCAN:
+      for (uint8_t i = 0; i < PLAYER_SCAN_PER_STEP; i++) {
+        File file = directory.openNextFile();
+        if (!file || trackCount == 0xFFFF) {
+          Serial.printf("Playlist has %u tracks.\n", trackCount);
+          directory.rewindDirectory();
+          directoryIndex = 0;
+          if (trackCount == 0) {
+            stopPlayback();
+            return;
+          }
+          loadTrack(0, true);
+          return;
+        }
+        if (!file.isDirectory()) {
+          trackCount++;
+        }
+      }
+      break;
+
+    case LOAD_SEEK:
+      for (uint8_t i = 0; i < PLAYER_SCAN_PER_STEP; i++) {
+        File file = directory.openNextFile();
+        if (!file) {
+          Serial.printf("Track %u of %s not found\n", loadIndex, playlistName);
+          stopPlayback();
+          return;
+        }
+        if (file.isDirectory()) {
+          continue;
+        }
+        if (directoryIndex++ == loadIndex) {
+          loadFile = file;
+          strncpy(loadName, file.name(), MAX_FILENAME_LENGTH);
+          loadName[MAX_FILENAME_LENGTH - 1] = 0;
+          loading = playWhenLoaded ? LOAD_TRACK : LOAD_READY;
+          return;
+        }
+      }
+      break;
+
+    case LOAD_TRACK:
+      loading = LOAD_IDLE;
+      position = loadPosition;
+      playNextFile();
+      break;
+
+    case LOAD_STREAM:
+      #ifdef HTTP_STREAMS
+        startStream();
+      #endif
+      break;
+
+    case LOAD_READY:
+    case LOAD_IDLE:
+      break;
+  }
+}
+
+/**
+ * Find the track at the given position of the play order, it is started
+ * right away or kept ready for nextTrack(). A new shuffled cycle gets a new
+ * seed. Directory entries are enumerated from the last track on, or from the
+ * beginning if the wanted one was passed already.
+ */
+void Player::loadTrack(uint16_t at, bool play) {
+  loadFile = File();
+  loadPosition = at;
+  playWhenLoaded = play;
+
+  if (!directory) {
+    strncpy(loadName, playlistName, MAX_FILENAME_LENGTH);
+    loading = play ? LOAD_TRACK : LOAD_READY;
+    return;
+  }
+
+  if (at == 0 && shuffleMode) {
+    shuffle.begin(trackCount, esp_random());
+  }
+  loadIndex = shuffleMode ? shuffle.at(at) : at;
+  if (loadIndex < directoryIndex) {
+    directory.rewindDirectory();
+    directoryIndex = 0;
+  }
+  loading = LOAD_SEEK;
+}
 
+void Player::cancelLoad() {
+  loading = LOAD_IDLE;
+  loadFile.close();
+}
+
+/**
+ * Play a sound from the SPIFFS partition, independent of the SD card.
+ */
+void Player::playSystemSoundFile(const char* filename) {
+  Serial.printf("Play system sound: %s\n", filename);
+  #ifdef HTTP_STREAMS
+    closeStream();
+  #endif
+  cancelLoad();
+  clearPlaylist();
+  fileSystem = &SPIFFS;
+  strncpy(playlistName, filename, MAX_FILENAME_LENGTH);
+  playlistName[MAX_FILENAME_LENGTH - 1] = 0;
+  strncpy(loadName, playlistName, MAX_FILENAME_LENGTH);
+  trackCount = 1;
+  position = 0;
   playNextFile();
 }
 
-void Player::addPlaylistEntry(char* filename) {
-    playlist[playlistLen] = (char*) malloc(MAX_FILENAME_LENGTH);
-    strncpy(playlist[playlistLen], filename, MAX_FILENAME_LENGTH);
-    playlistLen++;
+void Player::updatePlugins() {
+  Plugins(vs1053).update();
 }
 
 void Player::clearPlaylist() {
-  for(uint8_t i=0; i<playlistLen; i++) {
-    free(playlist[i]);
+  directory.close();
+  directory = File();
+  directoryIndex = 0;
+  trackCount = 0;
+  position = 0;
+  failedTracks = 0;
+}
+
+/**
+ * Switch through normal, shuffle, repeat and shuffle + repeat. The current
+ * track goes on, the play order is continued from its position in the new
+ * order.
+ */
+void Player::changeMode() {
+  uint16_t index = currentIndex();
+  if (shuffleMode) {
+    shuffleMode = false;
+    repeatMode = !repeatMode;
+  } else {
+    shuffleMode = true;
+  }
+  Serial.printf("Play mode: %s%s\n", shuffleMode ? "shuffle" : "in order", repeatMode ? ", repeat" : "");
+
+  if (trackCount > 0 && directory) {
+    if (shuffleMode) {
+      shuffle.begin(trackCount, esp_random());
+      position = shuffle.indexOf(index);
+    } else {
+      position = index;
+    }
+  }
+  // a track found ahead of time belongs to the old order
+  if ((loading == LOAD_SEEK || loading == LOAD_READY) && !playWhenLoaded) {
+    cancelLoad();
   }
-  playlistLen = 0;
-  playlistIndex = 0;
 }
 
-void Player::playNextFile() {
+// index of the current track in the directory
+uint16_t Player::currentIndex() {
+  return (shuffleMode && directory) ? shuffle.at(position) : position;
+}
 
-  if (playlistLen == 0) {
-    stop();   
+/**
+ * Position following the current one, false at the end of the playlist
+ * unless repeating. System sounds are never repeated.
+ */
+bool Player::nextPosition(uint16_t &next) {
+  next = position + 1;
+  if (next < trackCount) {
+    return true;
   }
+  next = 0;
+  return repeatMode && fileSystem == &SD;
+}
 
-  Serial.printf("Playing next file in playlist (%d/%d)\n", playlistIndex + 1, playlistLen);
+void Player::playNextFile() {
+  MallocAllowed opening;
+
+  Serial.printf("Playing track %u/%u\n", position + 1, trackCount);
 
   digitalWrite(AMP_ENABLE, HIGH);  // enable amplifier
   digitalWrite(LED2, HIGH);
   
-  char* filename = playlist[playlistIndex];
+  strncpy(trackName, loadName, MAX_FILENAME_LENGTH);
+  trackName[MAX_FILENAME_LENGTH - 1] = 0;
+  char* filename = trackName;
 
   Serial.printf("Filename: %s\n", filename);
 
-  dataFile = SD.open(filename, FILE_READ);
+  firstByteSent = false;
+  refilling = true;
+  seekPending = false;
+  telemetry.reset();
+  ringBuffer.empty();
+  headCache.abort();
+
+  // the file is still open from loadStep()
+  dataFile.close();
+  if (loadFile) {
+    dataFile = loadFile;
+    loadFile = File();
+  } else {
+    dataFile = fileSystem->open(filename, FILE_READ);
+  }
   if (!dataFile) {
-    next();
+    Serial.printf("Error opening file %s\n", filename);
+    if (++failedTracks < trackCount) {
+      nextTrack();
+    } else {
+      stopPlayback();
+    }
+    return;
   }
+  failedTracks = 0;
+  latencyTrace.event(TRACE_FILE_OPENED);
 
-  // skip ID3v2 tag if present
-  uint8_t header[10];
-  dataFile.read(header, 10);
-  if ((header[0] == 'I') && (header[1] == 'D') && (header[2] == '3')) {    
-    uint32_t header_size = header[9] + ((uint16_t)header[8] << 7) + ((uint32_t)header[7] << 14) + ((uint32_t)header[6] << 21);
-    Serial.printf("Found ID3v2 tag at beginning, skipping %d bytes\n", header_size);
-    dataFile.seek(header_size);    
-  } else {
-    dataFile.seek(0);
-  }  
+  // a recently played track starts from memory, unless the file was replaced
+  // since, the seek to where the cached head ends is done later
+  if (fileSystem == &SD && headCache.restore(filename, dataFile.size(), dataFile.getLastWrite(), ringBuffer, seekPosition)) {
+    latencyTrace.event(TRACE_TAG_SKIPPED);
+    layout.plain(seekPosition, seekPosition);
+    seekPending = true;
+    startPlaying();
+    return;
+  }
 
-  delay(300);
+  // skip tags and unneeded metadata, the container headers of recently played
+  // files are not walked again
+  if (fileSystem != &SD || !layoutCache.lookup(filename, dataFile.size(), layout)) {
+    analyzeStream(dataFile, layout);
+    if (fileSystem == &SD) {
+      layoutCache.store(filename, layout);
+    }
+  }
+  segmentIndex = 0;
+  prefixSent = 0;
+  dataFile.seek(layout.segments[0].start);
+  // system sounds are read from flash anyway, rearranged files are not cached
+  if (fileSystem == &SD && layout.simple()) {
+    headCache.record(filename, dataFile.size(), dataFile.getLastWrite(), layout.segments[0].start);
+  }
+  latencyTrace.event(TRACE_TAG_SKIPPED);
+
+  startPlaying();
+}
 
+#ifdef HTTP_STREAMS
+/**
+ * Play a network stream. Like a file it is opened by loadStep(), once WiFi
+ * is connected, the buffered audio of the previous track keeps playing
+ * meanwhile. Streams are neither repeated nor cached.
+ */
+void Player::playStream(const char* url) {
+  Serial.printf("Play stream: %s\n", url);
+  cancelLoad();
+  closeStream();
+  clearPlaylist();
+  fileSystem = NULL;
+  strncpy(playlistName, url, MAX_FILENAME_LENGTH);
+  playlistName[MAX_FILENAME_LENGTH - 1] = 0;
+
+  dataFile.close();
+  refilling = false;
+  seekPending = false;
+  headCache.abort();
+
+  if (!wlan.isEnabled()) {
+    Serial.printf("No WiFi configured, see %s\n", WIFI_CONFIG_FILE);
+    playSystemSoundFile(SYSTEM_SOUND_ERROR);
+    return;
+  }
+  wlan.start();
+  streamRequested = millis();
+  loading = LOAD_STREAM;
+}
+
+/**
+ * Wait for WiFi, then switch over to the stream. The connection is made by
+ * the first readStream(), the jitter buffer holds the decoder back until
+ * enough data arrived.
+ */
+void Player::startStream() {
+  if (!wlan.isConnected()) {
+    if (millis() - streamRequested > WIFI_CONNECT_TIMEOUT_MS) {
+      Serial.println("WiFi not connected");
+      cancelLoad();
+      playSystemSoundFile(SYSTEM_SOUND_ERROR);
+    }
+    return;
+  }
+  loading = LOAD_IDLE;
+  if (!stream.open(playlistName)) {
+    playSystemSoundFile(SYSTEM_SOUND_ERROR);
+    return;
+  }
+  strncpy(trackName, playlistName, MAX_FILENAME_LENGTH);
+  trackCount = 1;
+  position = 0;
+
+  digitalWrite(AMP_ENABLE, HIGH);  // enable amplifier
+  digitalWrite(LED2, HIGH);
+  firstByteSent = false;
+  telemetry.reset();
+  ringBuffer.empty();
+  layout.plain(0, 0);
+  streaming = true;
+  jitter.begin(streamRequested, ringBuffer.capacity());
+  startPlaying();
+}
+
+/**
+ * Network data has to be taken as it comes, there are no read bursts.
+ */
+void Player::readStream() {
+  uint32_t len;
+  uint8_t* ptr = ringBuffer.writePtr(len);
+  if (len > SD_READ_CHUNK) {
+    len = SD_READ_CHUNK;
+  }
+  if (len > 0) {
+    ringBuffer.commitWrite(stream.read(ptr, len));
+  }
+  if (stream.titleChanged()) {
+    Serial.printf("Stream title: %s\n", stream.title());
+  }
+  if (stream.failed() && ringBuffer.avail() == 0) {
+    playSystemSoundFile(SYSTEM_SOUND_ERROR);
+  }
+}
+
+// the radio is switched off a while later, unless another stream follows
+void Player::closeStream() {
+  if (streaming) {
+    stream.close();
+    streaming = false;
+  }
+  wlan.release();
+}
+#endif
+
+void Player::startPlaying() {
   state = PLAYING;
-  vs1053.setVolume(currentVolume);                 
 
+  // both are skipped by the register cache if nothing changed since the last track
   uint8_t tone[4] = {0,0,15,15};
+  vs1053.beginBatch();
+  // while a cancel is still running the volume is restored in process()
+  if (!vs1053.isCancelling()) {
+    vs1053.setVolume(currentVolume);
+  }
   vs1053.setTone(tone);
+  vs1053.endBatch();
 }
 
-void Player::next() {
-  if (playlistIndex + 1 < playlistLen) {
-    playlistIndex++;
+/**
+ * Continue with the next position, right away if its track was found ahead
+ * of time, otherwise once loadStep() found it.
+ */
+void Player::nextTrack() {
+  // a new playlist is still being loaded
+  if (loading == LOAD_OPEN || loading == LOAD_SCAN || loading == LOAD_TRACK || loading == LOAD_STREAM) {
+    return;
+  }
+  uint16_t next;
+  if (!nextPosition(next)) {
+    stopPlayback();
+    return;
+  }
+  if (loading == LOAD_READY && loadPosition == next) {
+    loading = LOAD_IDLE;
+    position = next;
     playNextFile();
-  } else {
-    stop();
+    return;
   }
+  if (loading == LOAD_SEEK && loadPosition == next) {
+    playWhenLoaded = true;
+    return;
+  }
+  loadTrack(next, true);
 }
 
-void Player::stop() {  
+/**
+ * Stop playback. The decoder is muted at once, cancelling the song on the
+ * VS1053 is done in the background by process(), so a following play
+ * command can already start reading from SD.
+ */
+void Player::stopPlayback() {  
+  cancelLoad();
+  #ifdef HTTP_STREAMS
+    closeStream();
+  #endif
   digitalWrite(AMP_ENABLE, LOW);  // disable amplifier
   digitalWrite(LED2, LOW);
   dataFile.close();
-  vs1053.processByte(0, true);
-  vs1053.setVolume(0);                  
-  vs1053.stopSong();                       
   ringBuffer.empty();                            
-  state = STOPPED; 
+  refilling = false;
+  seekPending = false;
+  headCache.abort();
   clearPlaylist();
+  awaitingDecoder = false;
+  if (state == STOPPED || state == STOPPING) {
+    return;
+  }
+  vs1053.setVolume(0);                  
+  vs1053.beginCancel();
+  state = STOPPING; 
 }
 
-void Player::process() {
+/**
+ * Advance a running cancel. A decoder which had to be reset lost its
+ * plugins, they are uploaded again.
+ */
+bool Player::processCancel() {
+  if (!vs1053.processCancel()) {
+    return false;
+  }
+  if (vs1053.wasReset()) {
+    MallocAllowed opening;
+    Plugins(vs1053).load();
+  }
+  return true;
+}
 
-  uint32_t maxfilechunk;
+void Player::process() {
 
   if (oldState != state) {
-    Serial.printf("Player state is now %d, was %d.\n", state, oldState);
+    LOG_INFO(LOG_PLAYER_STATE, state, oldState);
     oldState = state;
   }
-         
-  uint32_t timeGone = millis() - lastTime;
+
+  // a new file is loaded while the previous state carries on
+  if (loading != LOAD_IDLE && loading != LOAD_READY) {
+    loadStep();
+  }
 
   switch (state) {
 
     case PLAYING:      
-      // fill ring buffer with MP3 data
-      maxfilechunk = dataFile.available();
-      if (maxfilechunk > 1024) {
-        maxfilechunk = 1024;      
-      }
-      while (ringBuffer.space() && maxfilechunk--) {
-        ringBuffer.put(dataFile.read());
-      } 
+      fillBuffer();
       
-      // Try to keep VS1053 filled
-      while (vs1053.data_request() && ringBuffer.avail()) { 
-        vs1053.processByte(ringBuffer.get(), false);
+      // the previous song may still be cancelling, the buffer fills meanwhile
+      if (vs1053.isCancelling()) {
+        if (!processCancel()) {
+          break;
+        }
+        vs1053.setVolume(currentVolume);
+      }
+
+      #ifdef HTTP_STREAMS
+        if (streaming && !jitter.update(ringBuffer.avail(), sourceDone(), millis())) {
+          break;
+        }
+      #endif
+      feedDecoder();
+      pollDecoderRunning();
+
+      // find the next track of a directory while the current one plays out
+      if (loading == LOAD_IDLE && directory && !seekPending && sourceDone()) {
+        uint16_t next;
+        if (nextPosition(next)) {
+          loadTrack(next, false);
+        }
       }
 
-      // stop if data ends
-      if ((dataFile.available() == 0) && (ringBuffer.avail() == 0)) {      
-        next();
+      // go on if data ends
+      if ((loading == LOAD_IDLE || loading == LOAD_READY) && !seekPending && sourceDone() && (ringBuffer.avail() == 0)) {
+        nextTrack();
+      }
+      break;
+
+    case STOPPING:
+      if (processCancel()) {
+        state = STOPPED;
       }
-      idleTime = 0;
       break;
 
     case STOPPED:
-      #ifdef OLED
-        oled.trackName("");
-      #endif
-      idleTime += timeGone;
       break;    
     
   }
 }
 
+/**
+ * Read from SD in bursts: once the buffer dropped below the refill mark it is
+ * filled up completely, one chunk per call, then the card is left idle until
+ * the mark is reached again.
+ */
+void Player::fillBuffer() {
+  #ifdef HTTP_STREAMS
+    if (streaming) {
+      readStream();
+      return;
+    }
+  #endif
+
+  if (seekPending) {
+    if (!firstByteSent) {
+      return;
+    }
+    seekPendingFile();
+  }
+
+  if (!refilling) {
+    if (ringBuffer.avail() >= ringBuffer.capacity() / 100 * RINGBUFFER_REFILL_PERCENT || sourceDone()) {
+      return;
+    }
+    refilling = true;
+  }
+
+  if (ringBuffer.free() == 0 || sourceDone()) {
+    refilling = false;
+    sdBursts++;
+    return;
+  }
+
+  uint32_t start = micros();
+  sdBytesRead += readSource();
+  sdActiveMicros += micros() - start;
+}
+
+/**
+ * All of the layout has been read, or the file was closed after an error.
+ */
+bool Player::sourceDone() {
+  #ifdef HTTP_STREAMS
+    if (streaming) {
+      return stream.done();
+    }
+  #endif
+  if (!dataFile) {
+    return true;
+  }
+  if (prefixSent < layout.prefixLength) {
+    return false;
+  }
+  return segmentIndex + 1 >= layout.segmentCount && dataFile.position() >= layout.segments[segmentIndex].end;
+}
+
+/**
+ * Move the next part of the layout into the buffer: the prefix, up to
+ * SD_READ_CHUNK bytes of the current segment or the seek to the next one.
+ * Returns the number of bytes read from the file.
+ */
+uint32_t Player::readSource() {
+  if (prefixSent < layout.prefixLength) {
+    prefixSent += ringBuffer.write(layout.prefix + prefixSent, layout.prefixLength - prefixSent);
+    return 0;
+  }
+
+  uint32_t position = dataFile.position();
+  if (position >= layout.segments[segmentIndex].end) {
+    segmentIndex++;
+    dataFile.seek(layout.segments[segmentIndex].start);
+    if (segmentIndex == layout.patchSegment) {
+      patcher.begin(layout.chunkOffsetDelta);
+    }
+    return 0;
+  }
+
+  uint32_t remaining = layout.segments[segmentIndex].end - position;
+  if (segmentIndex == layout.patchSegment) {
+    return readPatched(position, remaining);
+  }
+
+  uint32_t len;
+  uint8_t* ptr = ringBuffer.writePtr(len);
+  if (len > SD_READ_CHUNK) {
+    len = SD_READ_CHUNK;
+  }
+  if (len > remaining) {
+    len = remaining;
+  }
+  SPI_TRACE_BEGIN();
+  int read = dataFile.read(ptr, len);
+  SPI_TRACE_END(SPI_DEVICE_SD, false, read > 0 ? read : 0);
+  if (read <= 0) {
+    Serial.printf("Read error at byte %u\n", position);
+    dataFile.close();
+    return 0;
+  }
+  ringBuffer.commitWrite(read);
+  headCache.append(ptr, read, sourceDone());
+  return read;
+}
+
+/**
+ * The moved moov atom goes through patchBuffer, where the chunk
+ * offsets are patched. Bytes the patcher holds back are read again.
+ */
+uint32_t Player::readPatched(uint32_t position, uint32_t remaining) {
+  uint32_t len = ringBuffer.free();
+  if (len > sizeof(patchBuffer)) {
+    len = sizeof(patchBuffer);
+  }
+  if (len > remaining) {
+    len = remaining;
+  }
+  SPI_TRACE_BEGIN();
+  int read = dataFile.read(patchBuffer, len);
+  SPI_TRACE_END(SPI_DEVICE_SD, false, read > 0 ? read : 0);
+  if (read <= 0) {
+    Serial.printf("Read error at byte %u\n", position);
+    dataFile.close();
+    return 0;
+  }
+  uint32_t released = patcher.patch(patchBuffer, read);
+  if ((uint32_t) read == remaining) {
+    // a truncated atom at the end of moov is passed as it is
+    released = read;
+  }
+  ringBuffer.write(patchBuffer, released);
+  if (released < (uint32_t) read) {
+    dataFile.seek(position + released);
+  }
+  return read;
+}
+
+// the first seek allocates the stdio buffer of the file
+void Player::seekPendingFile() {
+  MallocAllowed opening;
+  seekPending = false;
+  if (!dataFile) {
+    return;
+  }
+  dataFile.seek(seekPosition);
+  layout.plain(seekPosition, dataFile.size());
+  segmentIndex = 0;
+  prefixSent = 0;
+}
+
+// Try to keep VS1053 filled
+void Player::feedDecoder() {
+  if (!firstByteSent && vs1053.data_request() && ringBuffer.avail()) {
+    vs1053.resetDecodeTime();
+    telemetry.start();
+    firstByteSent = true;
+    awaitingDecoder = true;
+    latencyTrace.event(TRACE_FIRST_BYTE_SENT);
+  }
+  // the decoder accepts at least 32 bytes whenever DREQ is high
+  while (vs1053.data_request() && ringBuffer.avail()) { 
+    uint32_t len;
+    uint8_t* ptr = ringBuffer.readPtr(len);
+    if (len > 32) {
+      len = 32;
+    }
+    vs1053.playChunk(ptr, len);
+    ringBuffer.commitRead(len);
+    bytesFed += len;
+  }
+}
+
+/**
+ * After the first byte was sent, poll the decoder every millisecond until it
+ * reports a decoded header or decode time.
+ */
+void Player::pollDecoderRunning() {
+  if (!awaitingDecoder || (micros() - lastDecoderPoll) < 1000) {
+    return;
+  }
+  lastDecoderPoll = micros();
+  if (vs1053.isDecoding()) {
+    awaitingDecoder = false;
+    latencyTrace.event(TRACE_DECODER_RUNNING);
+  }
+}
+
+/**
+ * Low rate poll of the decoder status registers, skipped while nothing is
+ * decoded. Runs between data transfers, so the SPI bus is free.
+ */
+void Player::pollTelemetry() {
+  if (millis() - lastTelemetryPoll < TELEMETRY_POLL_MS) {
+    return;
+  }
+  lastTelemetryPoll = millis();
+  if (state != PLAYING || !firstByteSent || vs1053.isCancelling()) {
+    return;
+  }
+  uint16_t decodeTime, hdat0, hdat1, audata;
+  bool fifoFull = !vs1053.data_request();
+  vs1053.readStatus(decodeTime, hdat0, hdat1, audata);
+  telemetry.update(decodeTime, hdat0, hdat1, audata, fifoFull);
+}
+
 void Player::setVolume(uint8_t volume) {
   currentVolume = volume;
   if (currentVolume > 100) {
@@ -213,15 +1079,133 @@ void Player::setVolume(uint8_t volume) {
   if (currentVolume < 1) {
     currentVolume = 1;
   }
-  oled.volumeBar(currentVolume);
   vs1053.setVolume(currentVolume);
  }
 
-void Player::increaseVolume() {
-    setVolume(currentVolume+1);
+/**
+ * Jump relative to the current position, using the bit rate the decoder
+ * reports. Only MP3 can be entered at any point, the decoder resyncs on the
+ * next frame header.
+ */
+void Player::seekBy(int16_t seconds) {
+  if (state != PLAYING || telemetry.format != FORMAT_MP3 || telemetry.kbps == 0 || !layout.simple()) {
+    Serial.println("Seeking not possible");
+    return;
+  }
+  if (seekPending) {
+    seekPendingFile();
+  }
+  if (!dataFile) {
+    return;
+  }
+  int32_t position = (int32_t) dataFile.position() - (int32_t) ringBuffer.avail();
+  position += (int32_t) seconds * telemetry.kbps * 125;
+  if (position < (int32_t) layout.segments[0].start) {
+    position = layout.segments[0].start;
+  }
+  if (position > (int32_t) layout.segments[0].end) {
+    position = layout.segments[0].end;
+  }
+  Serial.printf("Seek to byte %d\n", position);
+  headCache.abort();
+  ringBuffer.empty();
+  dataFile.seek(position);
+  refilling = true;
+}
+
+/**
+ * Copy the current state to the snapshot read by other tasks.
+ */
+void Player::publish() {
+  PlayerStatus current;
+  current.state = state;
+  current.volume = currentVolume;
+  current.bufferFill = ringBuffer.avail();
+  current.bufferSize = ringBuffer.capacity();
+  current.bytesFed = bytesFed;
+  current.elapsedSeconds = telemetry.elapsedSeconds;
+  current.kbps = telemetry.kbps;
+  current.format = telemetry.format;
+  current.stalled = telemetry.stalled;
+  #ifdef HTTP_STREAMS
+    current.streaming = streaming;
+  #else
+    current.streaming = false;
+  #endif
+  current.shuffle = shuffleMode;
+  current.repeat = repeatMode;
+  current.track = position;
+  current.tracks = trackCount;
+  current.cardSequence = cardSequence;
+  current.cardResult = cardResult;
+  current.mappingSequence = mappingSequence;
+  current.mappingResult = mappingResult;
+  portENTER_CRITICAL(&statusMux);
+  published = current;
+  portEXIT_CRITICAL(&statusMux);
+}
+
+PlayerStatus Player::status() {
+  portENTER_CRITICAL(&statusMux);
+  PlayerStatus current = published;
+  portEXIT_CRITICAL(&statusMux);
+  return current;
+}
+
+/**
+ * Light sleep stalls both cores. It may only start while the player task
+ * waits for its queue between two iterations which left nothing half done.
+ * On success the task stays there until releaseAfterSleep().
+ */
+bool Player::holdForSleep() {
+  if (busy == NULL || xSemaphoreTake(busy, 0) != pdTRUE) {
+    return false;
+  }
+  if (!idle) {
+    xSemaphoreGive(busy);
+    return false;
+  }
+  return true;
+}
+
+void Player::releaseAfterSleep() {
+  xSemaphoreGive(busy);
 }
 
-void Player::decreaseVolume() {
-    setVolume(currentVolume-1);
+bool Player::isPlaying() {
+    return status().state == PLAYING;
+}
+
+uint32_t Player::bufferFill() {
+    return status().bufferFill;
+}
+
+uint32_t Player::bufferSize() {
+    return status().bufferSize;
+}
+
+/**
+ * Print and reset the SD card statistics. The active time is the time spent in
+ * SD reads, the card is idle for the rest of the interval.
+ */
+void Player::printStats() {
+  uint32_t elapsed = millis() - statsSince;
+  Serial.printf("Buffer %u bytes (%s), fill %u bytes\n", ringBuffer.capacity(), bufferInPsram ? "PSRAM" : "internal", ringBuffer.avail());
+  Serial.printf("Worst player iteration %u us\n", maxIterationMicros);
+  maxIterationMicros = 0;
+  headCache.printStats();
+  #ifdef HTTP_STREAMS
+    if (streaming) {
+      stream.print();
+      jitter.print();
+    }
+  #endif
+  Serial.printf("SD: %u bursts, %u bytes, active %u ms of %u ms (%u.%u%%)\n",
+    sdBursts, sdBytesRead, sdActiveMicros / 1000, elapsed,
+    elapsed ? sdActiveMicros / 10 / elapsed : 0, elapsed ? (sdActiveMicros / elapsed) % 10 : 0);
+  sdActiveMicros = 0;
+  sdBytesRead = 0;
+  sdBursts = 0;
+  statsSince = millis();
 }
 
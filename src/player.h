@@ -21,55 +21,244 @@
 #pragma once
 #include <FS.h>
 #include "Arduino.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "fatal.h"
 #ifdef OLED
   #include "oled.h"
 #endif
 #include "VS1053.h"
+#include "mapper.h"
 #include "ringbuffer.h"
+#include "headcache.h"
+#include "telemetry.h"
+#include "container.h"
+#include "shuffle.h"
+#ifdef HTTP_STREAMS
+  #include <WiFiClient.h>
+  #include "httpsource.h"
+  #include "jitter.h"
+#endif
 
-enum playerState_t {INITIALIZING, PLAYING, STOPPED};
+enum playerState_t {INITIALIZING, PLAYING, STOPPING, STOPPED};
 
+/**
+ * Read-only snapshot of the player, published by the player task after each
+ * iteration. cardSequence is incremented with every card command, cardResult
+ * holds the mapping result of the last one. mappingSequence is incremented
+ * whenever an edited mapping file was checked, mappingResult holds the result.
+ */
+struct PlayerStatus {
+  playerState_t state;
+  uint8_t volume;
+  uint32_t bufferFill;
+  uint32_t bufferSize;
+  uint32_t bytesFed;
+  uint16_t elapsedSeconds;
+  uint16_t kbps;
+  audioFormat_t format;
+  bool stalled;
+  bool streaming;
+  bool shuffle;
+  bool repeat;
+  uint16_t track;
+  uint16_t tracks;
+  uint16_t cardSequence;
+  Mapper::MapperError cardResult;
+  uint16_t mappingSequence;
+  Mapper::MapperError mappingResult;
+};
+
+/**
+ * The player runs in its own FreeRTOS task, which does all SD and VS1053
+ * data I/O. The public methods only post commands to a bounded queue and
+ * never block, if the queue is full the command is dropped.
+ */
 class Player {
 
   private:
+    enum CommandType {
+      CMD_PLAY,
+      CMD_PLAY_CARD,
+      CMD_PLAY_SYSTEM_SOUND,
+      CMD_STOP,
+      CMD_NEXT,
+      CMD_VOLUME,
+      CMD_SEEK,
+      CMD_PRINT_STATS,
+      CMD_PRINT_TELEMETRY,
+      CMD_MODE,
+      CMD_CHECK_MAPPING
+    };
+
+    struct Command {
+      CommandType type;
+      int16_t value;
+      byte card[ID_BYTE_ARRAY_LENGTH];
+      char filename[MAX_FILENAME_LENGTH];
+    };
+
     playerState_t state;
     playerState_t oldState;
-    Fatal fatal;
+    Fatal &fatal;
     #ifdef OLED
-      Oled oled;
+      Oled &oled;
     #endif
-    VS1053 vs1053;
+    VS1053 &vs1053;
+    Mapper &mapper;
     RingBuffer ringBuffer;
+    HeadCache headCache;
+    Telemetry telemetry;
 
     File dataFile;
+    fs::FS* fileSystem;
 
     uint8_t currentVolume;
 
-    char *playlist[MAX_PLAYLIST_LENGTH];
-    uint8_t playlistLen;
-    uint8_t playlistIndex;
+    // a single file or the files of a directory, only the position in the
+    // play order is kept, a shuffled order is computed from the seed
+    char playlistName[MAX_FILENAME_LENGTH];
+    char trackName[MAX_FILENAME_LENGTH];
+    File directory;
+    uint16_t directoryIndex;      // files enumerated since the last rewind
+    uint16_t trackCount;
+    uint16_t position;
+    uint16_t failedTracks;
+    bool shuffleMode;
+    bool repeatMode;
+    Shuffle shuffle;
+    void loadTrack(uint16_t at, bool play);
+    bool nextPosition(uint16_t &next);
+    uint16_t currentIndex();
+    void changeMode();
+
+    void playFile(const char* filename);
+    void resolveCard(byte card[ID_BYTE_ARRAY_LENGTH]);
+    void playSystemSoundFile(const char* filename);
     void playNextFile();
+    void startPlaying();
+    void nextTrack();
+    void stopPlayback();
+    void seekBy(int16_t seconds);
     void clearPlaylist();
-    void addPlaylistEntry(char* filename);
     void setVolume(uint8_t volume);
+    void process();
+    bool processCancel();
+    void feedDecoder();
+    void fillBuffer();
+    void printStats();
 
-    uint32_t lastTime;
+    // latency trace, set while waiting for the first byte resp. the decoder to start
+    bool firstByteSent;
+    bool awaitingDecoder;
+    uint32_t lastDecoderPoll;
+    void pollDecoderRunning();
+
+    // SD read bursts, refilling is set from the refill mark until the buffer is full
+    bool refilling;
+    bool bufferInPsram;
+    uint32_t sdActiveMicros;
+    uint32_t sdBytesRead;
+    uint32_t sdBursts;
+    uint32_t statsSince;
+
+    // set after a head cache hit, the file is positioned once the decoder got its first bytes
+    bool seekPending;
+    uint32_t seekPosition;
+    void seekPendingFile();
+
+    // how the current file is sent: prefix, then the segments in order
+    StreamLayout layout;
+    LayoutCache layoutCache;
+    ChunkOffsetPatcher patcher;
+    uint8_t patchBuffer[MP4_PATCH_CHUNK];
+    uint8_t segmentIndex;
+    uint8_t prefixSent;
+    bool sourceDone();
+    uint32_t readSource();
+    uint32_t readPatched(uint32_t position, uint32_t remaining);
+
+    uint32_t lastTelemetryPoll;
+    void pollTelemetry();
+
+    // files are opened and directories scanned a bounded step per iteration,
+    // the next track of a directory is found while the current one plays out
+    enum LoadStep {LOAD_IDLE, LOAD_OPEN, LOAD_SCAN, LOAD_SEEK, LOAD_READY, LOAD_TRACK, LOAD_STREAM};
+    LoadStep loading;
+    char loadName[MAX_FILENAME_LENGTH];
+    File loadFile;
+    uint16_t loadPosition;
+    uint16_t loadIndex;
+    bool playWhenLoaded;
+    void loadStep();
+    void cancelLoad();
+    uint32_t maxIterationMicros;
+
+    #ifdef HTTP_STREAMS
+      // network stream, read instead of dataFile while streaming is set. The
+      // decoder is only fed while the jitter buffer allows it.
+      WiFiClient streamClient;
+      HttpSource stream;
+      JitterBuffer jitter;
+      bool streaming;
+      uint32_t streamRequested;
+      void playStream(const char* url);
+      void startStream();
+      void readStream();
+      void closeStream();
+    #endif
+
+    // task, command queue and published snapshot
+    QueueHandle_t commands;
+    portMUX_TYPE statusMux;
+    PlayerStatus published;
+    uint16_t cardSequence;
+    Mapper::MapperError cardResult;
+    uint16_t mappingSequence;
+    Mapper::MapperError mappingResult;
+    void revalidateMapping();
+    uint32_t bytesFed;
+    static void task(void* player);
+    void run();
+    void handleCommand(Command &command);
+    bool post(Command &command);
+    bool post(CommandType type, int16_t value = 0);
+    void publish();
+
+    // held by the task except while it waits for its queue, taken by the
+    // governor for light sleep; idle tells whether that wait is a safe point
+    SemaphoreHandle_t busy;
+    volatile bool idle;
 
   public:
     #ifdef OLED
-      Player(Fatal fatal, Oled oled, VS1053 vs1053);
+      Player(Fatal &fatal, Oled &oled, VS1053 &vs1053, Mapper &mapper);
     #else
-      Player(Fatal fatal, VS1053 vs1053);
+      Player(Fatal &fatal, VS1053 &vs1053, Mapper &mapper);
     #endif
     void init();
-    void play(char* filename);
-    void stop();
-    void process();
-    void next();
+    void start();
+    void updatePlugins();
 
-    void increaseVolume();
-    void decreaseVolume();
+    bool play(const char* filename);
+    bool playCard(const byte card[ID_BYTE_ARRAY_LENGTH]);
+    bool playSystemSound(const char* filename);
+    bool stop();
+    bool next();
+    bool seek(int16_t seconds);
+    bool increaseVolume();
+    bool decreaseVolume();
+    bool requestStats();
+    bool requestTelemetry();
+    bool cycleMode();
+    bool checkMapping();
+    bool holdForSleep();
+    void releaseAfterSleep();
 
-    uint32_t idleTime;
-};
\ No newline at end of file
+    PlayerStatus status();
+    bool isPlaying();
+    uint32_t bufferFill();
+    uint32_t bufferSize();
+};
@@ -0,0 +1,134 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "plugins.h"
+#include <SD.h>
+#include <SPIFFS.h>
+
+Plugins::Plugins(VS1053 &_vs1053) : 
+  vs1053(_vs1053)
+  {}
+
+/**
+ * Mount the SPIFFS partition and upload the cached image, works without SD card.
+ * The partition is never formatted here, that would wipe the system sounds.
+ */
+void Plugins::load() {
+  if (!SPIFFS.begin(false)) {
+    Serial.println("SPIFFS mount failed, no plugins, system sounds and caches. Flash the partition with uploadfs.");
+    return;
+  }
+
+  File image = SPIFFS.open(PLUGIN_CACHE_FILE, FILE_READ);
+  if (!image) {
+    Serial.println("No plugin image found");
+    return;
+  }
+
+  uint32_t start = micros();
+  bool ok = vs1053.loadPlugin(image);
+  uint32_t duration = micros() - start;
+  Serial.printf("Plugin upload of %u bytes %s after %u us\n", (uint32_t) image.size(), ok ? "completed" : "failed", duration);
+  image.close();
+}
+
+/**
+ * Refresh the cached image from the SD card. As the decoder may already be
+ * playing the startup sound by then, a new image is uploaded on the next boot.
+ */
+bool Plugins::update() {
+  File source = SD.open(PLUGIN_FILE, FILE_READ);
+  if (!source) {
+    return false;
+  }
+  bool updated = false;
+  if (!cacheUpToDate(source)) {
+    updated = updateCache(source);
+    if (updated) {
+      Serial.println("Plugin image updated, it is loaded on the next boot");
+    } else {
+      Serial.printf("Plugin image %s is malformed\n", PLUGIN_FILE);
+    }
+  }
+  source.close();
+  return updated;
+}
+
+/**
+ * The cache is valid as long as size and modification time of the image on
+ * the SD card match the ones stored along with the cache.
+ */
+bool Plugins::cacheUpToDate(File &source) {
+  File meta = SPIFFS.open(PLUGIN_META_FILE, FILE_READ);
+  if (!meta) {
+    return false;
+  }
+  uint32_t stored[2] = {0, 0};
+  meta.read((uint8_t*) stored, sizeof(stored));
+  meta.close();
+  return (stored[0] == source.size()) && (stored[1] == (uint32_t) source.getLastWrite()) 
+    && SPIFFS.exists(PLUGIN_CACHE_FILE);
+}
+
+/**
+ * Copy the image to flash, checking the record structure on the way.
+ */
+bool Plugins::updateCache(File &source) {
+  Serial.printf("Caching plugin image %s\n", PLUGIN_FILE);
+  SPIFFS.remove(PLUGIN_META_FILE);
+  File cache = SPIFFS.open(PLUGIN_CACHE_FILE, FILE_WRITE);
+  if (!cache) {
+    return false;
+  }
+
+  uint8_t buf[64];
+  uint16_t header[2];
+  bool ok = true;
+  source.seek(0);
+  while (ok && source.available()) {
+    if (source.read((uint8_t*) header, sizeof(header)) != sizeof(header) || header[0] > 0xF) {
+      ok = false;
+      break;
+    }
+    cache.write((uint8_t*) header, sizeof(header));
+    uint32_t len = (header[1] & 0x8000) ? 2 : header[1] * 2;
+    while (len) {
+      uint16_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+      if (source.read(buf, chunk) != chunk) {
+        ok = false;
+        break;
+      }
+      cache.write(buf, chunk);
+      len -= chunk;
+    }
+  }
+  cache.close();
+
+  if (!ok) {
+    SPIFFS.remove(PLUGIN_CACHE_FILE);
+    return false;
+  }
+
+  uint32_t stored[2] = {(uint32_t) source.size(), (uint32_t) source.getLastWrite()};
+  File meta = SPIFFS.open(PLUGIN_META_FILE, FILE_WRITE);
+  meta.write((uint8_t*) stored, sizeof(stored));
+  meta.close();
+  return true;
+}
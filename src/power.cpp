@@ -0,0 +1,187 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "power.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#include <SPI.h>
+
+// pins kept at their level during deep sleep
+static const uint8_t heldPins[] = {AMP_ENABLE, SHUTDOWN, VS1053_XRESET_PIN, MFRC522_RST_PIN, MFRC522_CS_PIN};
+
+// card polls and time since the device went to deep sleep, survive deep sleep
+RTC_DATA_ATTR static uint32_t sleepPolls = 0;
+RTC_DATA_ATTR static uint32_t sleptMs = 0;
+RTC_DATA_ATTR static uint32_t pollAwakeMs = 0;   // sum of the time from app start to sleep
+
+#ifdef OLED
+  Power::Power(Player &_player, RFID &_rfid, Battery &_battery, Oled &_oled) : 
+    player(_player),
+    rfid(_rfid),
+    battery(_battery),
+    oled(_oled),
+    state(ACTIVE),
+    lastActivity(0)
+    {}
+#else
+  Power::Power(Player &_player, RFID &_rfid, Battery &_battery) : 
+    player(_player),
+    rfid(_rfid),
+    battery(_battery),
+    state(ACTIVE),
+    lastActivity(0)
+    {}
+#endif
+
+/**
+ * Call first thing in setup(), before anything which allocates or starts
+ * tasks, every card poll pays for it. After a timer wake up from deep sleep,
+ * check for a card and go back to sleep right away if there is none.
+ * Returns true if the device was woken up by a card, a wake up by the
+ * button boots normally.
+ */
+bool Power::checkWakeup(RFID &rfid) {
+  for (uint8_t i = 0; i < sizeof(heldPins); i++) {
+    gpio_hold_dis((gpio_num_t) heldPins[i]);
+  }
+  gpio_deep_sleep_hold_dis();
+
+  if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER) {
+    sleepPolls = 0;
+    return false;
+  }
+
+  SPI.begin(SPI_SCK_PIN, SPI_MISO_PIN, SPI_MOSI_PIN);
+  if (rfid.quickCheck()) {
+    Serial.printf("Woken up by card after %u polls, %u ms awake per poll\n", sleepPolls,
+      sleepPolls ? pollAwakeMs / sleepPolls : 0);
+    sleepPolls = 0;
+    return true;
+  }
+
+  sleepPolls++;
+  if (sleptMs >= POWER_OFF_MS) {
+    shutdown();
+  }
+  deepSleep(rfid);
+  return false;
+}
+
+void Power::init() {
+  lastActivity = millis();
+}
+
+/**
+ * Called once per second by the scheduler.
+ */
+void Power::update() {
+  if (digitalRead(LOW_BATT) == 0 || battery.percent() < BATTERY_SHUTDOWN_PERCENT) {
+    Serial.println("Battery low, shutting down");
+    shutdown();
+  }
+
+  if (player.isPlaying()) {
+    lastActivity = millis();
+  }
+  uint32_t idle = millis() - lastActivity;
+
+  switch (state) {
+    case ACTIVE:
+      if (idle >= POWER_IDLE_MS) {
+        Serial.println("Power state idle");
+        #ifdef OLED
+          oled.sleep();
+        #endif
+        state = IDLE;
+      }
+      break;
+    case IDLE:
+      if (idle < POWER_IDLE_MS) {
+        activity();
+      } else if (idle >= POWER_SLEEP_MS) {
+        enterDeepSleep();
+      }
+      break;
+  }
+}
+
+/**
+ * Card and button events, return to ACTIVE at once.
+ */
+void Power::activity() {
+  lastActivity = millis();
+  if (state != ACTIVE) {
+    Serial.println("Power state active");
+    #ifdef OLED
+      oled.wake();
+    #endif
+    state = ACTIVE;
+  }
+}
+
+void Power::enterDeepSleep() {
+  Serial.printf("Idle for %u s, going to deep sleep\n", (uint32_t) (millis() - lastActivity) / 1000);
+  player.stop();
+  #ifdef OLED
+    oled.sleep();
+  #endif
+  sleepPolls = 0;
+  sleptMs = 0;
+  pollAwakeMs = 0;
+  deepSleep(rfid);
+}
+
+/**
+ * Amplifier off, decoder and reader in reset, then sleep until the next card
+ * poll or a press of POWER_WAKE_BUTTON.
+ */
+void Power::deepSleep(RFID &rfid) {
+  rfid.powerDown();
+  for (uint8_t i = 0; i < sizeof(heldPins); i++) {
+    pinMode(heldPins[i], OUTPUT);
+  }
+  digitalWrite(AMP_ENABLE, LOW);
+  digitalWrite(SHUTDOWN, LOW);
+  digitalWrite(VS1053_XRESET_PIN, LOW);
+  digitalWrite(MFRC522_RST_PIN, LOW);         // hard power down of the reader
+  digitalWrite(MFRC522_CS_PIN, HIGH);
+  for (uint8_t i = 0; i < sizeof(heldPins); i++) {
+    gpio_hold_en((gpio_num_t) heldPins[i]);
+  }
+  gpio_deep_sleep_hold_en();
+
+  // the wake button reads low when pressed and has an external pull-up
+  esp_sleep_enable_ext0_wakeup((gpio_num_t) POWER_WAKE_BUTTON, 0);
+
+  uint32_t interval = sleptMs < POWER_FAST_POLL_MS ? POWER_CARD_POLL_MS : POWER_SLOW_POLL_MS;
+  sleptMs += interval;
+  if (sleepPolls > 0) {
+    pollAwakeMs += millis();
+  }
+  Serial.flush();
+  esp_sleep_enable_timer_wakeup((uint64_t) interval * 1000);
+  esp_deep_sleep_start();
+}
+
+void Power::shutdown() {
+  Serial.flush();
+  pinMode(SHUTDOWN, OUTPUT);
+  digitalWrite(SHUTDOWN, 1);
+}
@@ -0,0 +1,74 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+#include "player.h"
+#include "rfid.h"
+#include "battery.h"
+#ifdef OLED
+  #include "oled.h"
+#endif
+
+/**
+ * Power state machine driven by wall clock time:
+ * ACTIVE -> IDLE (display off) -> deep sleep -> power off.
+ *
+ * The MFRC522 has no low power card detection, so during deep sleep the
+ * ESP32 wakes up every POWER_CARD_POLL_MS, checks for a card with only SPI
+ * and the reader initialized and goes back to sleep if there is none.
+ * Each poll is a full boot, so after POWER_FAST_POLL_MS the polls slow down
+ * to POWER_SLOW_POLL_MS. A press of POWER_WAKE_BUTTON wakes the device at
+ * once.
+ */
+class Power {
+
+  public:
+    enum PowerState {
+      ACTIVE,
+      IDLE
+    };
+
+    #ifdef OLED
+      Power(Player &player, RFID &rfid, Battery &battery, Oled &oled);
+    #else
+      Power(Player &player, RFID &rfid, Battery &battery);
+    #endif
+    static bool checkWakeup(RFID &rfid);
+    void init();
+    void update();
+    void activity();
+
+  private:
+    Player &player;
+    RFID &rfid;
+    Battery &battery;
+    #ifdef OLED
+      Oled &oled;
+    #endif
+
+    PowerState state;
+    uint32_t lastActivity;
+
+    void enterDeepSleep();
+    static void deepSleep(RFID &rfid);
+    static void shutdown();
+};
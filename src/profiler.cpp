@@ -0,0 +1,151 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "profiler.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/xtensa_context.h"
+
+Profiler profiler;
+
+struct Slot {
+  uint32_t pc;
+  uint32_t count;
+};
+
+struct Histogram {
+  Slot slots[PROFILE_SLOTS];
+  uint32_t samples;
+  uint32_t dropped;
+  // samples for which EPC1 no longer held the interrupted PC
+  uint32_t overwritten;
+};
+
+// written by the timer interrupts only
+static DRAM_ATTR Histogram histograms[2];
+static hw_timer_t* timers[2] = {NULL, NULL};
+
+// a few probes, a full neighbourhood counts the sample as dropped
+#define PROFILE_PROBES 8
+
+Profiler::Profiler() : running(false), startedAt(0), duration(0) {}
+
+/**
+ * The timers are attached once, from a task on the core they are meant to
+ * interrupt, later runs only enable and disable the alarms.
+ */
+void Profiler::start() {
+  if (running) {
+    return;
+  }
+  memset(histograms, 0, sizeof(histograms));
+  running = true;
+  startedAt = millis();
+  for (uintptr_t core = 0; core < 2; core++) {
+    if (timers[core] == NULL) {
+      xTaskCreatePinnedToCore(attach, "profiler", 2048, (void*) core, configMAX_PRIORITIES - 1, NULL, core);
+    } else {
+      timerAlarmEnable(timers[core]);
+    }
+  }
+  Serial.printf("Profiler started, sampling every %u us\n", PROFILE_PERIOD_US);
+}
+
+void Profiler::attach(void* core) {
+  uintptr_t id = (uintptr_t) core;
+  hw_timer_t* timer = timerBegin(id == 0 ? PROFILE_TIMER_CORE0 : PROFILE_TIMER_CORE1, 80, true);  // 1 MHz
+  timerAttachInterrupt(timer, onTimer, true);
+  timerAlarmWrite(timer, PROFILE_PERIOD_US, true);
+  timerAlarmEnable(timer);
+  timers[id] = timer;
+  vTaskDelete(NULL);
+}
+
+void Profiler::stop() {
+  if (!running) {
+    return;
+  }
+  for (uint8_t core = 0; core < 2; core++) {
+    if (timers[core] != NULL) {
+      timerAlarmDisable(timers[core]);
+    }
+  }
+  running = false;
+  duration = millis() - startedAt;
+}
+
+bool Profiler::isRunning() {
+  return running;
+}
+
+/**
+ * The interrupted PC is taken from the frame the level 1 vector saved on the
+ * task's stack before anything else ran. The interrupt entry left the stack
+ * pointer of that frame in pxTopOfStack, the first member of the task's TCB.
+ * EPC1 is no good by now, a register window overflow on the way into the
+ * handler overwrites it; how often is counted for the dump.
+ */
+void IRAM_ATTR Profiler::onTimer() {
+  uint32_t core = xPortGetCoreID();
+  uint32_t* frame = *(uint32_t**) xTaskGetCurrentTaskHandleForCPU(core);
+  uint32_t pc = frame[XT_STK_PC / 4];
+  uint32_t epc1;
+  asm volatile ("rsr %0, epc1" : "=r" (epc1));
+  Histogram &histogram = histograms[core];
+  histogram.samples++;
+  if (epc1 != pc) {
+    histogram.overwritten++;
+  }
+
+  pc &= ~((1UL << PROFILE_BUCKET_BITS) - 1);
+  uint32_t index = pc >> PROFILE_BUCKET_BITS;
+  for (uint8_t probe = 0; probe < PROFILE_PROBES; probe++) {
+    Slot &slot = histogram.slots[(index + probe) & (PROFILE_SLOTS - 1)];
+    if (slot.pc == pc) {
+      slot.count++;
+      return;
+    }
+    if (slot.pc == 0) {
+      slot.pc = pc;
+      slot.count = 1;
+      return;
+    }
+  }
+  histogram.dropped++;
+}
+
+/**
+ * One line per PC bucket, stops the profiler first.
+ */
+void Profiler::dump() {
+  stop();
+  Serial.printf("PROFILE BEGIN %u ms, period %u us\n", duration, PROFILE_PERIOD_US);
+  for (uint8_t core = 0; core < 2; core++) {
+    Histogram &histogram = histograms[core];
+    Serial.printf("PROFILE CORE %u samples %u dropped %u epc1 %u\n", core, histogram.samples, histogram.dropped,
+      histogram.overwritten);
+    for (uint16_t i = 0; i < PROFILE_SLOTS; i++) {
+      if (histogram.slots[i].count) {
+        Serial.printf("PROFILE %u %08x %u\n", core, histogram.slots[i].pc, histogram.slots[i].count);
+      }
+    }
+  }
+  Serial.println("PROFILE END");
+}
@@ -0,0 +1,48 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+
+/**
+ * Sampling profiler. A timer interrupt on each core records the interrupted
+ * PC in a per core histogram, dump() prints it for tools/profile.py, which
+ * maps the addresses to functions using the firmware ELF.
+ */
+class Profiler {
+
+  public:
+    Profiler();
+    void start();
+    void stop();
+    bool isRunning();
+    void dump();
+
+  private:
+    bool running;
+    uint32_t startedAt;
+    uint32_t duration;
+
+    static void attach(void* core);
+    static void IRAM_ATTR onTimer();
+};
+
+extern Profiler profiler;
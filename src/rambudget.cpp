@@ -0,0 +1,115 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "rambudget.h"
+
+RamBudget ramBudget;
+
+// linker symbols of the ESP32 memory map
+extern int _data_start, _data_end, _bss_start, _bss_end;
+
+RamBudget::RamBudget() : count(0), current(NULL), heapBefore(0), psramBefore(0) {}
+
+RamBudget::Entry* RamBudget::find(const char* name) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (strcmp(entries[i].name, name) == 0) {
+      return &entries[i];
+    }
+  }
+  if (count == RAM_BUDGET_ENTRIES) {
+    return NULL;
+  }
+  Entry* entry = &entries[count++];
+  entry->name = name;
+  entry->staticBytes = 0;
+  entry->heapBytes = 0;
+  entry->task = NULL;
+  entry->stackBytes = 0;
+  return entry;
+}
+
+/**
+ * Start measuring the initialization of a subsystem, internal RAM and PSRAM
+ * taken until end() are booked to it. Calls must not be nested.
+ */
+void RamBudget::begin(const char* name, uint32_t staticBytes) {
+  current = find(name);
+  if (current != NULL) {
+    current->staticBytes = staticBytes;
+  }
+  heapBefore = ESP.getFreeHeap();
+  psramBefore = ESP.getFreePsram();
+}
+
+void RamBudget::end() {
+  if (current == NULL) {
+    return;
+  }
+  current->heapBytes += (int32_t) (heapBefore - ESP.getFreeHeap()) + (int32_t) (psramBefore - ESP.getFreePsram());
+  current = NULL;
+}
+
+// a subsystem without heap allocations
+void RamBudget::add(const char* name, uint32_t staticBytes) {
+  Entry* entry = find(name);
+  if (entry != NULL) {
+    entry->staticBytes = staticBytes;
+  }
+}
+
+/**
+ * Book a task to a subsystem, its stack is allocated from the heap.
+ */
+void RamBudget::task(const char* name, TaskHandle_t task, uint32_t stackBytes) {
+  Entry* entry = find(name);
+  if (entry != NULL) {
+    entry->task = task;
+    entry->stackBytes = stackBytes;
+  }
+}
+
+void RamBudget::print() {
+  Serial.println("RAM budget:");
+  Serial.println("  subsystem     static     heap    stack used/size");
+  uint32_t totalStatic = 0;
+  int32_t totalHeap = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    Entry &entry = entries[i];
+    Serial.printf("  %-10s %9u %8d", entry.name, entry.staticBytes, entry.heapBytes);
+    if (entry.task != NULL) {
+      // the ESP-IDF port counts the high-water mark in bytes
+      uint32_t unused = uxTaskGetStackHighWaterMark(entry.task);
+      Serial.printf("    %5u/%u", entry.stackBytes - unused, entry.stackBytes);
+    }
+    Serial.println();
+    totalStatic += entry.staticBytes;
+    totalHeap += entry.heapBytes;
+  }
+  Serial.printf("  %-10s %9u %8d\n", "total", totalStatic, totalHeap);
+
+  uint32_t data = (uint8_t*) &_data_end - (uint8_t*) &_data_start;
+  uint32_t bss = (uint8_t*) &_bss_end - (uint8_t*) &_bss_start;
+  Serial.printf("Image: %u bytes .data, %u bytes .bss\n", data, bss);
+  Serial.printf("Heap: %u of %u bytes free, minimum %u, largest block %u\n",
+    ESP.getFreeHeap(), ESP.getHeapSize(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+  if (ESP.getPsramSize() > 0) {
+    Serial.printf("PSRAM: %u of %u bytes free\n", ESP.getFreePsram(), ESP.getPsramSize());
+  }
+}
@@ -0,0 +1,60 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/**
+ * RAM used per subsystem: the size of its object, the heap taken by its
+ * initialization and, for tasks, the stack high-water mark. Static sizes of
+ * the whole image are reported by tools/rambudget.py from the firmware ELF.
+ */
+class RamBudget {
+
+  private:
+    struct Entry {
+      const char* name;
+      uint32_t staticBytes;
+      int32_t heapBytes;
+      TaskHandle_t task;
+      uint32_t stackBytes;
+    };
+
+    Entry entries[RAM_BUDGET_ENTRIES];
+    uint8_t count;
+    Entry* current;
+    uint32_t heapBefore;
+    uint32_t psramBefore;
+
+    Entry* find(const char* name);
+
+  public:
+    RamBudget();
+    void begin(const char* name, uint32_t staticBytes);
+    void end();
+    void add(const char* name, uint32_t staticBytes);
+    void task(const char* name, TaskHandle_t task, uint32_t stackBytes);
+    void print();
+};
+
+extern RamBudget ramBudget;
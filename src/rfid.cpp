@@ -20,6 +20,8 @@
  */
 #include "rfid.h"
 #include "tools.h"
+#include "trace.h"
+#include "spitrace.h"
 
 RFID::RFID(uint8_t _csPin, uint8_t _rstPin) : 
   csPin(_csPin),
@@ -33,12 +35,33 @@ void RFID::init() {
   // mfrc522.PCD_SetAntennaGain(mfrc522.RxGain_max);
 }
 
+/**
+ * Initialize the reader and check once for a card in the field, without
+ * selecting it. Used right after waking up from deep sleep.
+ */
+bool RFID::quickCheck() {
+  mfrc522.PCD_Init();
+  return mfrc522.PICC_IsNewCardPresent();
+}
+
+/**
+ * Soft power down, the next PCD_Init() wakes the reader up again.
+ */
+void RFID::powerDown() {
+  mfrc522.PCD_WriteRegister(MFRC522::CommandReg, 0x10);   // PowerDown bit, idle command
+}
+
 RFID::CardState RFID::checkCardState() {
   
-  if (mfrc522.PICC_IsNewCardPresent()) {
+  // the regular poll, reading the serial only follows when a card is found
+  SPI_TRACE_BEGIN();
+  bool present = mfrc522.PICC_IsNewCardPresent();
+  SPI_TRACE_END(SPI_DEVICE_RFID, false, 0);
+  if (present) {
     if (mfrc522.PICC_ReadCardSerial()) {
       cardFailCount = 0;    
       if (cardChanged(mfrc522.uid.uidByte, mfrc522.uid.size)) {
+        latencyTrace.event(TRACE_CARD_DETECTED);
         newCard(mfrc522.uid.uidByte, mfrc522.uid.size);        
         return CardState::NEW_CARD;        
       }      
@@ -18,6 +18,7 @@
  * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
  *  
  */
+#pragma once
 #include "Arduino.h"
 #include "config.h"
 #include <MFRC522.h>
@@ -35,6 +36,8 @@ class RFID {
     RFID(uint8_t _csPin, uint8_t _rstPin);
     void init();
     CardState checkCardState();
+    bool quickCheck();
+    void powerDown();
 
     byte currentCard[ID_BYTE_ARRAY_LENGTH];
 
@@ -19,13 +19,27 @@
  *  
  */
 #include "ringbuffer.h"
+#include "arena.h"
 
-RingBuffer::RingBuffer(uint32_t s)  {
+RingBuffer::RingBuffer()  {
+  size = 0;
+  buf = NULL;
+  empty();
+}
+
+/**
+ * Take the buffer from the boot-time arena, once. On failure false is
+ * returned and the buffer stays without storage.
+ */
+bool RingBuffer::allocate(uint32_t s) {
+  uint8_t* b = (uint8_t *) arena.alloc("ringbuffer", s);
+  if (b == NULL) {
+    return false;
+  }
+  buf = b;
   size = s;
-  buf = (uint8_t *) malloc (size);
-  rindex = size - 1;
-  windex = 0;
-  count = 0;
+  empty();
+  return true;
 }
 
 // True is at least one byte of free space is available
@@ -34,10 +48,19 @@ bool RingBuffer::space() {
 }
 
 // Return number of bytes available
-uint16_t RingBuffer::avail() {
+uint32_t RingBuffer::avail() {
   return count;                     
 }
 
+// Return number of bytes free
+uint32_t RingBuffer::free() {
+  return size - count;
+}
+
+uint32_t RingBuffer::capacity() {
+  return size;
+}
+
 // Put one byte in the ringbuffer
 void RingBuffer::put(uint8_t b) {
   *(buf + windex) = b;
@@ -48,15 +71,75 @@ void RingBuffer::put(uint8_t b) {
 }
 
 uint8_t RingBuffer::get() {
+  uint8_t b = *(buf + rindex);
   if ( ++rindex == size ) { 
     rindex = 0;                   
   }
   count--;                         
-  return *(buf + rindex);
+  return b;
 }
 
 void RingBuffer::empty() {
   windex = 0;                
-  rindex = size - 1;
+  rindex = 0;
   count = 0;
 }
+
+/**
+ * Pointer to the free space, len is set to the number of bytes which can be
+ * written there without wrapping around.
+ */
+uint8_t* RingBuffer::writePtr(uint32_t &len) {
+  uint32_t toEnd = size - windex;
+  uint32_t available = size - count;
+  len = available < toEnd ? available : toEnd;
+  return buf + windex;
+}
+
+void RingBuffer::commitWrite(uint32_t len) {
+  windex += len;
+  if ( windex >= size ) {
+    windex -= size;
+  }
+  count += len;
+}
+
+/**
+ * Copy as much of data as fits, wrapping around if needed. Returns the number
+ * of bytes written.
+ */
+uint32_t RingBuffer::write(const uint8_t* data, uint32_t len) {
+  uint32_t written = 0;
+  while (written < len) {
+    uint32_t n;
+    uint8_t* ptr = writePtr(n);
+    if (n == 0) {
+      break;
+    }
+    if (n > len - written) {
+      n = len - written;
+    }
+    memcpy(ptr, data + written, n);
+    commitWrite(n);
+    written += n;
+  }
+  return written;
+}
+
+/**
+ * Pointer to the oldest data, len is set to the number of bytes which can be
+ * read there without wrapping around.
+ */
+uint8_t* RingBuffer::readPtr(uint32_t &len) {
+  uint32_t toEnd = size - rindex;
+  len = count < toEnd ? count : toEnd;
+  return buf + rindex;
+}
+
+void RingBuffer::commitRead(uint32_t len) {
+  rindex += len;
+  if ( rindex >= size ) {
+    rindex -= size;
+  }
+  count -= len;
+}
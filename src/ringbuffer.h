@@ -18,6 +18,7 @@
  * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
  *  
  */
+#pragma once
 #include "Arduino.h"
 
 class RingBuffer {
@@ -25,16 +26,27 @@ class RingBuffer {
   private:
     uint32_t size;
     uint8_t* buf;                                 
-    uint16_t windex;                            
-    uint16_t rindex;                
-    uint16_t count;                              
+    uint32_t windex;                            
+    uint32_t rindex;                
+    uint32_t count;                              
 
   public:
-    RingBuffer ( uint32_t size );
+    RingBuffer ();
+    bool allocate ( uint32_t size );
     bool space();
-    uint16_t avail();
+    uint32_t avail();
+    uint32_t free();
+    uint32_t capacity();
     void put(uint8_t b);
     uint8_t get();
     void empty();
 
+    // zero copy access to the contiguous part of the free resp. used space
+    uint8_t* writePtr(uint32_t &len);
+    void commitWrite(uint32_t len);
+    uint8_t* readPtr(uint32_t &len);
+    void commitRead(uint32_t len);
+
+    uint32_t write(const uint8_t* data, uint32_t len);
+
 };
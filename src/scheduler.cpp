@@ -0,0 +1,141 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "scheduler.h"
+
+Scheduler::Scheduler() : taskCount(0), statsSince(0) {}
+
+/**
+ * Register a task. Tasks are kept sorted by priority, highest first.
+ */
+void Scheduler::add(const char* name, TaskFunction function, uint32_t periodMs, uint32_t deadlineMs, uint8_t priority) {
+  if (taskCount == SCHEDULER_MAX_TASKS) {
+    Serial.printf("Too many tasks, %s not scheduled\n", name);
+    return;
+  }
+  uint8_t i = taskCount++;
+  while (i > 0 && tasks[i - 1].priority < priority) {
+    tasks[i] = tasks[i - 1];
+    i--;
+  }
+  Task &task = tasks[i];
+  memset(&task, 0, sizeof(Task));
+  task.name = name;
+  task.function = function;
+  task.period = periodMs * 1000;
+  task.deadline = deadlineMs * 1000;
+  task.priority = priority;
+  task.release = micros();
+}
+
+bool Scheduler::due(Task &task, uint32_t now) {
+  return (int32_t) (now - task.release) >= 0;
+}
+
+void Scheduler::execute(Task &task) {
+  uint32_t start = micros();
+  uint32_t lateness = start - task.release;
+  if (lateness > task.maxLateness) {
+    task.maxLateness = lateness;
+  }
+  if (lateness > task.deadline) {
+    task.overruns++;
+  }
+
+  task.function();
+
+  uint32_t end = micros();
+  uint32_t runtime = end - start;
+  task.runs++;
+  task.totalRuntime += runtime;
+  if (runtime > task.maxRuntime) {
+    task.maxRuntime = runtime;
+  }
+
+  // period 0 tasks are released again right away, lateness is measured from their last run
+  task.release += task.period;
+  if (task.period == 0 || (int32_t) (end - task.release) > (int32_t) task.period) {
+    // fell behind more than one period, skip the missed releases
+    task.release = end + task.period;
+  }
+}
+
+void Scheduler::run() {
+  for (uint8_t i = 0; i < taskCount; i++) {
+    if (!due(tasks[i], micros())) {
+      continue;
+    }
+    execute(tasks[i]);
+    // only strictly higher priorities, equal ones earlier in the list would starve later ones
+    for (uint8_t h = 0; h < i && tasks[h].priority > tasks[i].priority; h++) {
+      if (due(tasks[h], micros())) {
+        execute(tasks[h]);
+      }
+    }
+  }
+}
+
+/**
+ * How long the loop may sleep: until the first periodic task would be late
+ * by half of its deadline, 0 if that is already the case. Tasks released
+ * meanwhile run together after the sleep. Tasks with period 0 run whenever
+ * the loop runs and are not considered.
+ */
+uint32_t Scheduler::microsUntilNextDeadline() {
+  uint32_t now = micros();
+  uint32_t result = UINT32_MAX;
+  for (uint8_t i = 0; i < taskCount; i++) {
+    if (tasks[i].period == 0) {
+      continue;
+    }
+    int32_t remaining = (int32_t) (tasks[i].release + tasks[i].deadline / 2 - now);
+    if (remaining <= 0) {
+      return 0;
+    }
+    if ((uint32_t) remaining < result) {
+      result = remaining;
+    }
+  }
+  return result;
+}
+
+void Scheduler::printStats() {
+  uint32_t elapsed = micros() - statsSince;
+  Serial.printf("Scheduler stats for the last %u ms:\n", elapsed / 1000);
+  Serial.println("task        prio     runs  load%   avg us   max us  late us  overruns");
+  for (uint8_t i = 0; i < taskCount; i++) {
+    Task &t = tasks[i];
+    uint32_t avg = t.runs ? t.totalRuntime / t.runs : 0;
+    uint32_t load = elapsed ? (uint32_t) (t.totalRuntime * 1000 / elapsed) : 0;
+    Serial.printf("%-10s %5d %8u %3u.%u %8u %8u %8u %9u\n", t.name, t.priority, t.runs,
+      load / 10, load % 10, avg, t.maxRuntime, t.maxLateness, t.overruns);
+  }
+}
+
+void Scheduler::resetStats() {
+  for (uint8_t i = 0; i < taskCount; i++) {
+    tasks[i].runs = 0;
+    tasks[i].overruns = 0;
+    tasks[i].maxLateness = 0;
+    tasks[i].totalRuntime = 0;
+    tasks[i].maxRuntime = 0;
+  }
+  statsSince = micros();
+}
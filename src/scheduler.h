@@ -0,0 +1,68 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+
+/**
+ * Cooperative scheduler for periodic tasks. Every pass of run() executes
+ * each due task once, ordered by priority. After every task, higher priority
+ * tasks which are due again get a turn, so a task with period 0 (audio)
+ * runs between all others.
+ *
+ * A task is released every period, it overruns if it starts later than its
+ * deadline after the release.
+ */
+class Scheduler {
+
+  public:
+    typedef void (*TaskFunction)();
+
+    Scheduler();
+    void add(const char* name, TaskFunction function, uint32_t periodMs, uint32_t deadlineMs, uint8_t priority);
+    void run();
+    void printStats();
+    void resetStats();
+    uint32_t microsUntilNextDeadline();
+
+  private:
+    struct Task {
+      const char* name;
+      TaskFunction function;
+      uint32_t period;        // us
+      uint32_t deadline;      // us
+      uint8_t priority;       // higher runs first
+      uint32_t release;       // us, time of the next release
+
+      uint32_t runs;
+      uint32_t overruns;
+      uint32_t maxLateness;   // us
+      uint64_t totalRuntime;  // us
+      uint32_t maxRuntime;    // us
+    };
+
+    Task tasks[SCHEDULER_MAX_TASKS];
+    uint8_t taskCount;
+    uint32_t statsSince;
+
+    bool due(Task &task, uint32_t now);
+    void execute(Task &task);
+};
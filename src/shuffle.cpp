@@ -0,0 +1,97 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "shuffle.h"
+
+#define SHUFFLE_ROUNDS 6
+
+Shuffle::Shuffle() : count(0), seed(0), halfBits(1) {}
+
+void Shuffle::begin(uint16_t _count, uint32_t _seed) {
+  count = _count;
+  seed = _seed;
+  halfBits = 1;
+  while ((1UL << (2 * halfBits)) < count) {
+    halfBits++;
+  }
+}
+
+uint32_t Shuffle::getSeed() const {
+  return seed;
+}
+
+// integer hash of one half, the seed and the round number
+uint32_t Shuffle::round(uint32_t half, uint8_t round) const {
+  uint32_t x = (half + 1) * 0x9E3779B1UL ^ seed ^ (round * 0x85EBCA6BUL);
+  x ^= x >> 16;
+  x *= 0x7FEB352DUL;
+  x ^= x >> 15;
+  x *= 0x846CA68BUL;
+  x ^= x >> 16;
+  return x & ((1UL << halfBits) - 1);
+}
+
+uint32_t Shuffle::encrypt(uint32_t value) const {
+  uint32_t left = value >> halfBits;
+  uint32_t right = value & ((1UL << halfBits) - 1);
+  for (uint8_t r = 0; r < SHUFFLE_ROUNDS; r++) {
+    uint32_t next = left ^ round(right, r);
+    left = right;
+    right = next;
+  }
+  return (left << halfBits) | right;
+}
+
+uint32_t Shuffle::decrypt(uint32_t value) const {
+  uint32_t left = value >> halfBits;
+  uint32_t right = value & ((1UL << halfBits) - 1);
+  for (uint8_t r = SHUFFLE_ROUNDS; r > 0; r--) {
+    uint32_t previous = right ^ round(left, r - 1);
+    right = left;
+    left = previous;
+  }
+  return (left << halfBits) | right;
+}
+
+/**
+ * Index played at the given position. The range covered by the network is
+ * less than four times count, so a few rounds of walking are enough.
+ */
+uint16_t Shuffle::at(uint16_t position) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint32_t value = position;
+  do {
+    value = encrypt(value);
+  } while (value >= count);
+  return value;
+}
+
+uint16_t Shuffle::indexOf(uint16_t index) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint32_t value = index;
+  do {
+    value = decrypt(value);
+  } while (value >= count);
+  return value;
+}
@@ -0,0 +1,48 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+
+/**
+ * Seeded permutation of 0..count-1 without any table: a balanced Feistel
+ * network over the smallest even number of bits covering count, results
+ * outside the range are encrypted again (cycle walking). Every index is
+ * returned exactly once per seed, and the position of an index can be found
+ * by running the network backwards.
+ */
+class Shuffle {
+
+  public:
+    Shuffle();
+    void begin(uint16_t count, uint32_t seed);
+    uint16_t at(uint16_t position) const;
+    uint16_t indexOf(uint16_t index) const;
+    uint32_t getSeed() const;
+
+  private:
+    uint16_t count;
+    uint32_t seed;
+    uint8_t halfBits;
+
+    uint32_t round(uint32_t half, uint8_t round) const;
+    uint32_t encrypt(uint32_t value) const;
+    uint32_t decrypt(uint32_t value) const;
+};
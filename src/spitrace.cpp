@@ -0,0 +1,85 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "spitrace.h"
+
+#ifdef SPI_TRACE
+
+SpiTrace spiTrace;
+
+// transactions come from the main loop and the player task
+static portMUX_TYPE spiTraceMux = portMUX_INITIALIZER_UNLOCKED;
+
+SpiTrace::SpiTrace() : count(0), running(false) {}
+
+void SpiTrace::start() {
+  count = 0;
+  running = true;
+  Serial.printf("SPI trace started, room for %u transactions\n", SPI_TRACE_TRANSACTIONS);
+}
+
+void SpiTrace::stop() {
+  running = false;
+}
+
+bool SpiTrace::isRunning() {
+  return running;
+}
+
+uint16_t SpiTrace::recorded() {
+  return count;
+}
+
+void SpiTrace::record(spiDevice_t device, bool write, uint32_t length, uint32_t start) {
+  if (!running) {
+    return;
+  }
+  uint32_t duration = micros() - start;
+  portENTER_CRITICAL(&spiTraceMux);
+  if (count < SPI_TRACE_TRANSACTIONS) {
+    Transaction &t = transactions[count++];
+    t.start = start;
+    t.duration = duration > 0xFFFF ? 0xFFFF : duration;
+    t.length = length > 0xFFFF ? 0xFFFF : length;
+    t.device = device;
+    t.write = write;
+  }
+  if (count == SPI_TRACE_TRANSACTIONS) {
+    running = false;
+  }
+  portEXIT_CRITICAL(&spiTraceMux);
+}
+
+/**
+ * One line per transaction: start in us, duration in us, device, direction
+ * and length in bytes.
+ */
+void SpiTrace::dump() {
+  stop();
+  Serial.printf("SPITRACE BEGIN %u\n", count);
+  for (uint16_t i = 0; i < count; i++) {
+    Transaction &t = transactions[i];
+    Serial.printf("SPI %u %u %u %c %u\n", t.start, t.duration, t.device, t.write ? 'W' : 'R', t.length);
+  }
+  Serial.println("SPITRACE END");
+  count = 0;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+
+enum spiDevice_t {
+  SPI_DEVICE_VS1053_SCI,
+  SPI_DEVICE_VS1053_SDI,
+  SPI_DEVICE_SD,
+  SPI_DEVICE_RFID
+};
+
+#ifdef SPI_TRACE
+
+/**
+ * Capture of SPI transactions for tools/spitrace.py. Recording starts with
+ * start() and ends with stop() or when the buffer is full, it is kept until
+ * it was dumped. SD transactions
+ * are file reads, including the overhead of the file system, RFID ones the
+ * complete card poll of unknown length.
+ */
+class SpiTrace {
+
+  private:
+    struct Transaction {
+      uint32_t start;
+      uint16_t duration;
+      uint16_t length;
+      uint8_t device;
+      bool write;
+    };
+
+    Transaction transactions[SPI_TRACE_TRANSACTIONS];
+    uint16_t count;
+    bool running;
+
+  public:
+    SpiTrace();
+    void start();
+    void stop();
+    bool isRunning();
+    uint16_t recorded();
+    void record(spiDevice_t device, bool write, uint32_t length, uint32_t start);
+    void dump();
+};
+
+extern SpiTrace spiTrace;
+
+  #define SPI_TRACE_BEGIN() uint32_t spiTraceStart = micros()
+  #define SPI_TRACE_END(device, write, length) spiTrace.record(device, write, length, spiTraceStart)
+#else
+  #define SPI_TRACE_BEGIN()
+  #define SPI_TRACE_END(device, write, length)
+#endif
@@ -0,0 +1,94 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "tags.h"
+
+/**
+ * Length of an ID3v2 tag at the beginning of a file, including its header and
+ * footer, i.e. the offset of the audio data. Returns 0 if there is no tag.
+ * The tag size is stored as a 28 bit synchsafe integer.
+ */
+uint32_t id3v2TagLength(const uint8_t header[ID3V2_HEADER_LENGTH]) {
+  if ((header[0] != 'I') || (header[1] != 'D') || (header[2] != '3')) {
+    return 0;
+  }
+  if ((header[6] | header[7] | header[8] | header[9]) & 0x80) {
+    return 0;
+  }
+  uint32_t size = header[9] + ((uint16_t)header[8] << 7) + ((uint32_t)header[7] << 14) + ((uint32_t)header[6] << 21);
+  size += ID3V2_HEADER_LENGTH;
+  // footer present
+  if (header[5] & 0x10) {
+    size += ID3V2_HEADER_LENGTH;
+  }
+  return size;
+}
+
+/**
+ * Guess the format from the first bytes of the audio data, i.e. after any
+ * ID3v2 tag. Anything unknown is left to the decoder.
+ */
+audioFormat_t sniffFormat(const uint8_t head[SNIFF_LENGTH]) {
+  if (memcmp(head, "fLaC", 4) == 0) {
+    return FORMAT_FLAC;
+  }
+  if (memcmp(head, "OggS", 4) == 0) {
+    return FORMAT_VORBIS;
+  }
+  if (memcmp(head + 4, "ftyp", 4) == 0) {
+    return FORMAT_AAC;
+  }
+  if (memcmp(head, "RIFF", 4) == 0) {
+    return FORMAT_WAV;
+  }
+  if ((head[0] == 0xFF) && ((head[1] & 0xE0) == 0xE0)) {
+    return FORMAT_MP3;
+  }
+  return FORMAT_UNKNOWN;
+}
+
+/**
+ * FLAC metadata block header: last block flag, 7 bit type and 24 bit length.
+ * Returns the length of the block data.
+ */
+uint32_t flacBlockHeader(const uint8_t header[FLAC_BLOCK_HEADER], bool &last, uint8_t &type) {
+  last = header[0] & 0x80;
+  type = header[0] & 0x7F;
+  return readBigEndian(header + 1, 3);
+}
+
+/**
+ * MP4 atom header: 32 bit size including the header and a four character
+ * type. A size of 1 means a 64 bit size follows, 0 that the atom extends to
+ * the end of the file.
+ */
+uint32_t mp4AtomHeader(const uint8_t header[MP4_ATOM_HEADER], char type[5]) {
+  memcpy(type, header + 4, 4);
+  type[4] = 0;
+  return readBigEndian(header, 4);
+}
+
+uint32_t readBigEndian(const uint8_t* data, uint8_t bytes) {
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < bytes; i++) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
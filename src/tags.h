@@ -0,0 +1,36 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+
+#define ID3V2_HEADER_LENGTH 10
+#define SNIFF_LENGTH        12
+#define FLAC_BLOCK_HEADER   4
+#define FLAC_STREAMINFO     34
+#define MP4_ATOM_HEADER     8
+
+enum audioFormat_t {FORMAT_UNKNOWN, FORMAT_MP3, FORMAT_AAC, FORMAT_VORBIS, FORMAT_WMA, FORMAT_FLAC, FORMAT_WAV, FORMAT_MIDI};
+
+uint32_t id3v2TagLength(const uint8_t header[ID3V2_HEADER_LENGTH]);
+audioFormat_t sniffFormat(const uint8_t head[SNIFF_LENGTH]);
+uint32_t flacBlockHeader(const uint8_t header[FLAC_BLOCK_HEADER], bool &last, uint8_t &type);
+uint32_t mp4AtomHeader(const uint8_t header[MP4_ATOM_HEADER], char type[5]);
+uint32_t readBigEndian(const uint8_t* data, uint8_t bytes);
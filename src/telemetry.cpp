@@ -0,0 +1,121 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "telemetry.h"
+
+// MPEG layer III bit rates in kbit/s, indexed by the bit rate index
+static const uint16_t mpeg1Kbps[16] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0};
+static const uint16_t mpeg2Kbps[16] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0};
+
+static const char* formatNames[] = {"-", "MP3", "AAC", "Vorbis", "WMA", "FLAC", "WAV", "MIDI"};
+
+Telemetry::Telemetry() :
+  stalls(0)
+  {
+  reset();
+}
+
+// Called for each new track
+void Telemetry::reset() {
+  elapsedSeconds = 0;
+  kbps = 0;
+  sampleRate = 0;
+  channels = 0;
+  format = FORMAT_UNKNOWN;
+  stalled = false;
+  lastProgress = millis();
+}
+
+// Called when the first byte of a track was sent, the stall timer runs from here
+void Telemetry::start() {
+  lastProgress = millis();
+  stalled = false;
+}
+
+/**
+ * HDAT1 holds the MP3 sync word or a two character format id.
+ */
+audioFormat_t Telemetry::decodeFormat(uint16_t hdat1) {
+  if (hdat1 >= 0xFFE0) {
+    return FORMAT_MP3;
+  }
+  switch (hdat1) {
+    case 0x4154:  // "AT", ADTS
+    case 0x4144:  // "AD", ADIF
+    case 0x4D34:  // "M4", MP4
+      return FORMAT_AAC;
+    case 0x4F67:  // "Og"
+      return FORMAT_VORBIS;
+    case 0x574D:  // "WM"
+      return FORMAT_WMA;
+    case 0x664C:  // "fL"
+      return FORMAT_FLAC;
+    case 0x7665:  // "ve"
+      return FORMAT_WAV;
+    case 0x4D54:  // "MT"
+      return FORMAT_MIDI;
+  }
+  return FORMAT_UNKNOWN;
+}
+
+/**
+ * For MP3, HDAT0 bits 15:12 are the bit rate index and HDAT1 bits 4:3 the
+ * MPEG version (3 = MPEG 1).
+ */
+uint16_t Telemetry::mp3Kbps(uint16_t hdat0, uint16_t hdat1) {
+  uint8_t index = hdat0 >> 12;
+  return ((hdat1 >> 3) & 3) == 3 ? mpeg1Kbps[index] : mpeg2Kbps[index];
+}
+
+void Telemetry::update(uint16_t decodeTime, uint16_t hdat0, uint16_t hdat1, uint16_t audata, bool fifoFull) {
+  format = decodeFormat(hdat1);
+  if (format == FORMAT_MP3) {
+    kbps = mp3Kbps(hdat0, hdat1);
+  } else {
+    // all other formats report the measured data rate in bytes per second
+    kbps = (uint32_t) hdat0 * 8 / 1000;
+  }
+  sampleRate = audata & 0xFFFE;
+  channels = (audata & 1) ? 2 : 1;
+
+  // a decoder which never starts stays at 0 and counts as stalled as well
+  if (decodeTime != elapsedSeconds || !fifoFull) {
+    elapsedSeconds = decodeTime;
+    lastProgress = millis();
+    stalled = false;
+  } else if (!stalled && millis() - lastProgress > TELEMETRY_STALL_MS) {
+    stalled = true;
+    stalls++;
+    Serial.printf("Decoder stalled at %u s\n", elapsedSeconds);
+  }
+}
+
+const char* Telemetry::formatName() {
+  return formatName(format);
+}
+
+const char* Telemetry::formatName(audioFormat_t format) {
+  return formatNames[format];
+}
+
+void Telemetry::print() {
+  Serial.printf("%s %u kbit/s %u Hz %s, %u:%02u, %s, %u stalls\n", formatName(), kbps, sampleRate,
+    channels == 2 ? "stereo" : "mono", elapsedSeconds / 60, elapsedSeconds % 60, stalled ? "stalled" : "running", stalls);
+}
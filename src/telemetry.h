@@ -0,0 +1,58 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+#include "tags.h"
+
+/**
+ * Playback state decoded from the VS1053 status registers. The values are
+ * cached, update() is called at a low rate with fresh register contents.
+ *
+ * Decoding counts as stalled when the decode time did not advance for
+ * TELEMETRY_STALL_MS although the decoder FIFO was full at every poll, so
+ * running out of data is not mistaken for a stall.
+ */
+class Telemetry {
+
+  public:
+    Telemetry();
+    void reset();
+    void start();
+    void update(uint16_t decodeTime, uint16_t hdat0, uint16_t hdat1, uint16_t audata, bool fifoFull);
+    void print();
+    const char* formatName();
+    static const char* formatName(audioFormat_t format);
+
+    uint16_t elapsedSeconds;
+    uint16_t kbps;
+    uint16_t sampleRate;
+    uint8_t channels;
+    audioFormat_t format;
+    bool stalled;
+
+  private:
+    uint32_t lastProgress;
+    uint32_t stalls;
+
+    audioFormat_t decodeFormat(uint16_t hdat1);
+    uint16_t mp3Kbps(uint16_t hdat0, uint16_t hdat1);
+};
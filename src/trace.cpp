@@ -0,0 +1,126 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "trace.h"
+
+LatencyTrace latencyTrace;
+
+// events are recorded by the main loop and the player task
+static portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* stageNames[TRACE_NUM_STAGES] = {
+  "card detected",
+  "mapping resolved",
+  "file opened",
+  "tag skipped",
+  "first byte sent",
+  "decoder running"
+};
+
+LatencyTrace::LatencyTrace() : windex(0), count(0) {}
+
+void LatencyTrace::event(traceStage_t stage) {
+  portENTER_CRITICAL(&traceMux);
+  events[windex].micros = micros();
+  events[windex].stage = stage;
+  if (++windex == TRACE_EVENTS) {
+    windex = 0;
+  }
+  if (count < TRACE_EVENTS) {
+    count++;
+  }
+  portEXIT_CRITICAL(&traceMux);
+}
+
+void LatencyTrace::clear() {
+  windex = 0;
+  count = 0;
+}
+
+/**
+ * Collect the durations of one stage. Every card detection starts a new
+ * sequence, each stage is measured against the stage before it. Repeated
+ * events of a stage within one sequence (e.g. following playlist tracks)
+ * are ignored. TRACE_NUM_STAGES collects the whole way from card to sound.
+ */
+uint16_t LatencyTrace::collect(uint8_t stage, uint32_t* samples) {
+  uint16_t n = 0;
+  uint32_t seen[TRACE_NUM_STAGES];
+  bool inSequence = false;
+  uint8_t lastStage = 0;
+
+  uint16_t rindex = (windex + TRACE_EVENTS - count) % TRACE_EVENTS;
+  for (uint16_t i = 0; i < count; i++) {
+    Event &e = events[(rindex + i) % TRACE_EVENTS];
+    if (e.stage == TRACE_CARD_DETECTED) {
+      inSequence = true;
+      lastStage = TRACE_CARD_DETECTED;
+      seen[TRACE_CARD_DETECTED] = e.micros;
+      continue;
+    }
+    if (!inSequence || e.stage != lastStage + 1) {
+      continue;
+    }
+    seen[e.stage] = e.micros;
+    if (e.stage == stage) {
+      samples[n++] = e.micros - seen[lastStage];
+    }
+    if (e.stage == TRACE_DECODER_RUNNING) {
+      if (stage == TRACE_NUM_STAGES) {
+        samples[n++] = e.micros - seen[TRACE_CARD_DETECTED];
+      }
+      inSequence = false;
+    }
+    lastStage = e.stage;
+  }
+  return n;
+}
+
+void LatencyTrace::dump() {
+  static uint32_t samples[TRACE_EVENTS];
+
+  Serial.printf("Latency trace, %d events (us, relative to previous stage):\n", count);
+  Serial.println("stage                  n      p50      p95      max");
+  for (uint8_t s = TRACE_MAPPING_RESOLVED; s < TRACE_NUM_STAGES; s++) {
+    printStage(stageNames[s], samples, collect(s, samples));
+  }
+  printStage("card to sound", samples, collect(TRACE_NUM_STAGES, samples));
+}
+
+void LatencyTrace::printStage(const char* name, uint32_t* samples, uint16_t n) {
+  // insertion sort, n is small
+  for (uint16_t i = 1; i < n; i++) {
+    uint32_t v = samples[i];
+    int16_t j = i - 1;
+    while (j >= 0 && samples[j] > v) {
+      samples[j + 1] = samples[j];
+      j--;
+    }
+    samples[j + 1] = v;
+  }
+  if (n == 0) {
+    Serial.printf("%-18s %5d        -        -        -\n", name, n);
+    return;
+  }
+  Serial.printf("%-18s %5d %8u %8u %8u\n", name, n,
+    samples[(n - 1) * 50 / 100],
+    samples[(n - 1) * 95 / 100],
+    samples[n - 1]);
+}
@@ -0,0 +1,64 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+
+/**
+ * Stages of the way from placing a card to hearing sound, in their natural order.
+ */
+enum traceStage_t {
+  TRACE_CARD_DETECTED,
+  TRACE_MAPPING_RESOLVED,
+  TRACE_FILE_OPENED,
+  TRACE_TAG_SKIPPED,
+  TRACE_FIRST_BYTE_SENT,
+  TRACE_DECODER_RUNNING,
+  TRACE_NUM_STAGES
+};
+
+/**
+ * Fixed size ring of timestamped events. Recording is cheap, all statistics
+ * are computed when the trace is dumped.
+ */
+class LatencyTrace {
+
+  private:
+    struct Event {
+      uint32_t micros;
+      uint8_t stage;
+    };
+
+    Event events[TRACE_EVENTS];
+    uint16_t windex;
+    uint16_t count;
+
+    uint16_t collect(uint8_t stage, uint32_t* samples);
+    void printStage(const char* name, uint32_t* samples, uint16_t n);
+
+  public:
+    LatencyTrace();
+    void event(traceStage_t stage);
+    void dump();
+    void clear();
+};
+
+extern LatencyTrace latencyTrace;
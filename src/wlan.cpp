@@ -0,0 +1,121 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#include "wlan.h"
+#include "arena.h"
+#include <WiFi.h>
+#include <SD.h>
+
+Wlan wlan;
+
+Wlan::Wlan() : enabled(false), active(false), inUse(false), releasedAt(0) {
+  ssid[0] = 0;
+  password[0] = 0;
+}
+
+// one line without the line break
+static void readConfigLine(File &file, char* str, uint8_t size) {
+  uint8_t i = 0;
+  while (true) {
+    int c = file.read();
+    if (c < 0 || c == '\n') {
+      break;
+    }
+    if (c != '\r' && i < size - 1) {
+      str[i++] = c;
+    }
+  }
+  str[i] = 0;
+}
+
+/**
+ * Read SSID and password from WIFI_CONFIG_FILE, the radio stays off.
+ */
+bool Wlan::begin() {
+  WiFi.mode(WIFI_OFF);
+  File config = SD.open(WIFI_CONFIG_FILE, FILE_READ);
+  if (!config) {
+    return false;
+  }
+  readConfigLine(config, ssid, sizeof(ssid));
+  readConfigLine(config, password, sizeof(password));
+  config.close();
+  if (ssid[0] == 0) {
+    Serial.printf("No SSID in %s\n", WIFI_CONFIG_FILE);
+    return false;
+  }
+  enabled = true;
+  return true;
+}
+
+/**
+ * Switch the radio on and start connecting, does not wait for the
+ * connection. The WiFi driver and lwIP allocate from the heap while the
+ * radio is on, the arena checks pause meanwhile.
+ */
+void Wlan::start() {
+  inUse = true;
+  if (active || !enabled) {
+    return;
+  }
+  arena.suspend();
+  // the credentials are read on every boot, do not wear the flash
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.setSleep(true);
+  WiFi.setAutoReconnect(true);
+  WiFi.begin(ssid, password[0] ? password : NULL);
+  Serial.printf("Connecting to WiFi %s\n", ssid);
+  active = true;
+}
+
+// no stream needs the radio anymore, update() switches it off later
+void Wlan::release() {
+  if (inUse) {
+    inUse = false;
+    releasedAt = millis();
+  }
+}
+
+void Wlan::update() {
+  if (active && !inUse && millis() - releasedAt > WIFI_IDLE_OFF_MS) {
+    stop();
+  }
+}
+
+void Wlan::stop() {
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  active = false;
+  arena.resume();
+  Serial.println("WiFi off");
+}
+
+bool Wlan::isEnabled() {
+  return enabled;
+}
+
+bool Wlan::isActive() {
+  return active;
+}
+
+bool Wlan::isConnected() {
+  return active && WiFi.status() == WL_CONNECTED;
+}
@@ -0,0 +1,55 @@
+/**
+ * 
+ * Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+ * 
+ * This file is part of esp32-audioplayer.
+ * 
+ * esp32-audioplayer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32-audioplayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+ *  
+ */
+#pragma once
+#include "Arduino.h"
+#include "config.h"
+
+/**
+ * WiFi station for network streams. The credentials are read at boot, the
+ * radio is only switched on by start() when a stream is played and off
+ * again WIFI_IDLE_OFF_MS after the last one, so playing from the SD card
+ * costs no WiFi current. Modem sleep is used while connected.
+ *
+ * start(), release() and update() are called by the player task only.
+ */
+class Wlan {
+
+  public:
+    Wlan();
+    bool begin();
+    void start();
+    void release();
+    void update();
+    bool isEnabled();
+    bool isActive();
+    bool isConnected();
+
+  private:
+    bool enabled;
+    volatile bool active;
+    bool inUse;
+    uint32_t releasedAt;
+    char ssid[33];
+    char password[65];
+    void stop();
+};
+
+extern Wlan wlan;
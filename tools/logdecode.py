@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+#
+# Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+#
+# This file is part of esp32-audioplayer.
+#
+# esp32-audioplayer is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-audioplayer is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+#
+"""
+Expand the binary log frames in a serial capture of the firmware, see
+src/binlog.h. Message formats are read from the logMessage_t enum, text
+output between the frames is passed through unchanged.
+
+usage: logdecode.py [capture.bin] [--port /dev/ttyUSB0] [--baud 115200]
+       (reads stdin if neither a file nor a port is given)
+"""
+import argparse
+import os
+import re
+import struct
+import sys
+
+SYNC = b"\xa5\x5a"
+HEADER = struct.Struct("<HIB")
+MAX_ARGS = 3
+
+
+def load_messages(header):
+    """Format strings in enum order, from the comment behind each entry."""
+    messages = []
+    in_enum = False
+    with open(header) as f:
+        for line in f:
+            if line.startswith("enum logMessage_t"):
+                in_enum = True
+            elif in_enum and line.startswith("}"):
+                break
+            elif in_enum:
+                m = re.match(r'\s*(LOG_\w+),\s*(?://\s*"(.*)")?', line)
+                if m:
+                    messages.append((m.group(1), m.group(2)))
+    return messages
+
+
+def expand(messages, msg_id, args):
+    if msg_id >= len(messages) or messages[msg_id][1] is None:
+        return "unknown message %d %s" % (msg_id, " ".join("%08x" % a for a in args))
+    fmt = messages[msg_id][1].replace("%u", "%d")
+    try:
+        return fmt % tuple(args)
+    except TypeError:
+        return "%s %s" % (messages[msg_id][0], " ".join(str(a) for a in args))
+
+
+class Decoder:
+    def __init__(self, messages, out):
+        self.messages = messages
+        self.out = out
+        self.buf = b""
+
+    def feed(self, data):
+        self.buf += data
+        while True:
+            pos = self.buf.find(SYNC)
+            if pos < 0:
+                # keep a possible first sync byte for the next chunk
+                keep = 1 if self.buf.endswith(SYNC[:1]) else 0
+                self.text(self.buf[:len(self.buf) - keep])
+                self.buf = self.buf[len(self.buf) - keep:]
+                return
+            self.text(self.buf[:pos])
+            self.buf = self.buf[pos:]
+            if len(self.buf) < len(SYNC) + HEADER.size:
+                return
+            msg_id, millis, argc = HEADER.unpack_from(self.buf, len(SYNC))
+            if argc > MAX_ARGS:
+                # not a frame, pass the sync byte on as text
+                self.text(self.buf[:1])
+                self.buf = self.buf[1:]
+                continue
+            end = len(SYNC) + HEADER.size + 4 * argc
+            if len(self.buf) < end:
+                return
+            args = struct.unpack_from("<%dI" % argc, self.buf, len(SYNC) + HEADER.size)
+            self.buf = self.buf[end:]
+            self.out.write("[%8.3f] %s\n" % (millis / 1000.0, expand(self.messages, msg_id, args)))
+
+    def text(self, data):
+        if data:
+            self.out.write(data.decode("utf-8", "replace"))
+        self.out.flush()
+
+
+def main():
+    default_header = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src", "binlog.h")
+    parser = argparse.ArgumentParser(description=__doc__.strip().split("\n")[0])
+    parser.add_argument("capture", nargs="?", help="raw serial capture")
+    parser.add_argument("--port", help="read from a serial port (needs pyserial)")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--header", default=default_header, help="binlog.h with the message formats")
+    args = parser.parse_args()
+
+    decoder = Decoder(load_messages(args.header), sys.stdout)
+    if args.port:
+        import serial
+        with serial.Serial(args.port, args.baud, timeout=0.1) as port:
+            while True:
+                decoder.feed(port.read(256))
+    else:
+        source = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+        while True:
+            data = source.read(4096)
+            if not data:
+                break
+            decoder.feed(data)
+        decoder.text(decoder.buf)
+
+
+if __name__ == "__main__":
+    main()
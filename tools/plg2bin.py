@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+#
+# Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+#
+# This file is part of esp32-audioplayer.
+#
+# esp32-audioplayer is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-audioplayer is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+#
+"""
+Convert one or more VLSI .plg files (C arrays in the compressed plugin
+format) into the binary image read by the firmware (/patches.plg on the
+SD card): the 16 bit words of all plugins, little endian, concatenated.
+
+usage: plg2bin.py vs1053b-patches.plg [more.plg ...] -o patches.plg
+"""
+import argparse
+import re
+import struct
+import sys
+
+
+def parse_plg(text):
+    body = text[text.index("{", text.index("plugin")) + 1:]
+    body = body[:body.index("}")]
+    body = re.sub(r"/\*.*?\*/", "", body, flags=re.S)
+    return [int(tok, 0) for tok in re.findall(r"0[xX][0-9a-fA-F]+|\d+", body)]
+
+
+def validate(words):
+    i = 0
+    while i < len(words):
+        if i + 2 > len(words):
+            raise ValueError("truncated record header at word %d" % i)
+        addr, n = words[i], words[i + 1]
+        if addr > 0xF:
+            raise ValueError("bad register 0x%x at word %d" % (addr, i))
+        i += 3 if n & 0x8000 else 2 + n
+    if i != len(words):
+        raise ValueError("truncated record data")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("plg", nargs="+")
+    parser.add_argument("-o", "--output", required=True)
+    args = parser.parse_args()
+
+    words = []
+    for name in args.plg:
+        with open(name) as f:
+            plugin = parse_plg(f.read())
+        validate(plugin)
+        print("%s: %d words" % (name, len(plugin)))
+        words += plugin
+
+    with open(args.output, "wb") as f:
+        f.write(struct.pack("<%dH" % len(words), *words))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
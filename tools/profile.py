@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+#
+# Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+#
+# This file is part of esp32-audioplayer.
+#
+# esp32-audioplayer is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-audioplayer is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+#
+"""
+Map the samples of the firmware profiler (serial command 'p') to functions.
+Reads the PROFILE lines from a serial log, resolves the addresses with
+addr2line against the firmware ELF and prints the functions with the most
+samples per core.
+
+usage: profile.py serial.log [--elf firmware.elf] [--top 20] [--lines]
+       (reads stdin if no log is given)
+"""
+import argparse
+import collections
+import re
+import subprocess
+import sys
+
+SAMPLE = re.compile(r"PROFILE (\d) ([0-9a-fA-F]{8}) (\d+)")
+CORE = re.compile(r"PROFILE CORE (\d) samples (\d+) dropped (\d+)(?: epc1 (\d+))?")
+# interrupt entry, dispatch and register window handlers, samples landing
+# here hide the code that was interrupted
+DISPATCHER = re.compile(r"^(_xt_|_frxt_|xt_int|_WindowOverflow|_WindowUnderflow|__timerISR|shared_intr_isr)")
+BEGIN = re.compile(r"PROFILE BEGIN (\d+) ms")
+
+
+def read_profile(lines):
+    samples = collections.defaultdict(collections.Counter)
+    totals = {}
+    duration = 0
+    for line in lines:
+        m = BEGIN.search(line)
+        if m:
+            # only the last dump in the log counts
+            samples.clear()
+            totals.clear()
+            duration = int(m.group(1))
+            continue
+        m = CORE.search(line)
+        if m:
+            totals[int(m.group(1))] = (int(m.group(2)), int(m.group(3)), int(m.group(4) or 0))
+            continue
+        m = SAMPLE.search(line)
+        if m:
+            samples[int(m.group(1))][int(m.group(2), 16)] += int(m.group(3))
+    return duration, samples, totals
+
+
+def resolve(addr2line, elf, addresses):
+    """Function and file:line for each address, in one addr2line call."""
+    addresses = sorted(addresses)
+    if not addresses:
+        return {}
+    cmd = [addr2line, "-f", "-C", "-e", elf] + ["0x%08x" % a for a in addresses]
+    try:
+        out = subprocess.run(cmd, stdout=subprocess.PIPE, check=True, universal_newlines=True).stdout.splitlines()
+    except (OSError, subprocess.CalledProcessError) as e:
+        sys.exit("addr2line failed: %s" % e)
+    result = {}
+    for i, address in enumerate(addresses):
+        function, location = out[2 * i], out[2 * i + 1]
+        result[address] = (function, location.split(" ")[0])
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split("\n")[0])
+    parser.add_argument("log", nargs="?", help="serial log containing a profile dump")
+    parser.add_argument("--elf", default=".pio/build/nodemcu-32s/firmware.elf")
+    parser.add_argument("--addr2line", default="xtensa-esp32-elf-addr2line")
+    parser.add_argument("--top", type=int, default=20)
+    parser.add_argument("--lines", action="store_true", help="report source lines instead of functions")
+    args = parser.parse_args()
+
+    source = open(args.log, errors="replace") if args.log else sys.stdin
+    duration, samples, totals = read_profile(source)
+    if not samples:
+        sys.exit("no profile found, start and stop the profiler with 'p'")
+
+    symbols = resolve(args.addr2line, args.elf, set(a for core in samples.values() for a in core))
+    print("Profile of %.1f s" % (duration / 1000.0))
+    for core in sorted(samples):
+        total, dropped, overwritten = totals.get(core, (sum(samples[core].values()), 0, 0))
+        by_key = collections.Counter()
+        dispatcher = 0
+        for address, count in samples[core].items():
+            function, location = symbols[address]
+            by_key[location if args.lines else function] += count
+            if DISPATCHER.match(function):
+                dispatcher += count
+        share = lambda n: 100.0 * n / total if total else 0
+        print("\nCore %d: %d samples, %d dropped" % (core, total, dropped))
+        print("%.2f%% in the interrupt dispatcher, EPC1 overwritten in %.2f%%" % (share(dispatcher), share(overwritten)))
+        for key, count in by_key.most_common(args.top):
+            print("%6.2f%% %7d  %s" % (share(count), count, key))
+
+
+if __name__ == "__main__":
+    main()
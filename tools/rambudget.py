@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+#
+# Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+#
+# This file is part of esp32-audioplayer.
+#
+# esp32-audioplayer is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-audioplayer is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+#
+"""
+Static RAM of the firmware per subsystem. Lists the .data and .bss symbols of
+the firmware ELF with nm and sums them per source file of src/, per library
+and for the framework. Limits make the script fail when a subsystem grows
+beyond its budget, the heap and stack side is printed by the serial
+command 'r'.
+
+usage: rambudget.py [--elf firmware.elf] [--symbols 5] [--limit player=40000 ...]
+"""
+import argparse
+import collections
+import os
+import re
+import subprocess
+import sys
+
+SYMBOL = re.compile(r"^([0-9a-fA-F]+) ([0-9a-fA-F]+) ([bBdD]) ([^\t]+)(?:\t(.*))?$")
+LIBRARY = re.compile(r"/(?:libraries|libdeps/[^/]+)/([^/]+)/")
+
+
+def subsystem(location):
+    """Name of the subsystem a symbol was defined in, from its file:line."""
+    if not location:
+        return "(framework)"
+    path = location.rsplit(":", 1)[0].replace("\\", "/")
+    if "/src/" in path and "/framework-" not in path:
+        return os.path.splitext(os.path.basename(path))[0]
+    m = LIBRARY.search(path)
+    if m:
+        return m.group(1)
+    return "(framework)"
+
+
+def read_symbols(nm, elf):
+    cmd = [nm, "-S", "-C", "-l", elf]
+    try:
+        out = subprocess.run(cmd, stdout=subprocess.PIPE, check=True, universal_newlines=True).stdout
+    except (OSError, subprocess.CalledProcessError) as e:
+        sys.exit("nm failed: %s" % e)
+    symbols = []
+    for line in out.splitlines():
+        m = SYMBOL.match(line)
+        if m:
+            symbols.append((subsystem(m.group(5)), m.group(4), int(m.group(2), 16), m.group(3).lower()))
+    return symbols
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split("\n")[0])
+    parser.add_argument("--elf", default=".pio/build/nodemcu-32s/firmware.elf")
+    parser.add_argument("--nm", default="xtensa-esp32-elf-nm")
+    parser.add_argument("--symbols", type=int, default=0, help="largest symbols listed per subsystem")
+    parser.add_argument("--limit", action="append", default=[], metavar="NAME=BYTES",
+                        help="budget of a subsystem, 'total' for all of them")
+    args = parser.parse_args()
+
+    data = collections.Counter()
+    bss = collections.Counter()
+    largest = collections.defaultdict(list)
+    for name, symbol, size, kind in read_symbols(args.nm, args.elf):
+        (data if kind == "d" else bss)[name] += size
+        largest[name].append((size, symbol))
+
+    totals = data + bss
+    print("%-24s %8s %8s %8s" % ("subsystem", ".data", ".bss", "total"))
+    for name, total in totals.most_common():
+        print("%-24s %8d %8d %8d" % (name, data[name], bss[name], total))
+        for size, symbol in sorted(largest[name], reverse=True)[:args.symbols]:
+            print("    %8d  %s" % (size, symbol))
+    print("%-24s %8d %8d %8d" % ("total", sum(data.values()), sum(bss.values()), sum(totals.values())))
+
+    over = False
+    for limit in args.limit:
+        name, _, budget = limit.partition("=")
+        used = sum(totals.values()) if name == "total" else totals[name]
+        if used > int(budget):
+            print("%s uses %d bytes, budget is %s" % (name, used, budget), file=sys.stderr)
+            over = True
+    sys.exit(1 if over else 0)
+
+
+if __name__ == "__main__":
+    main()
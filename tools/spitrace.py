@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+#
+# Copyright 2018 D.Zerlett <daniel@zerlett.eu>
+#
+# This file is part of esp32-audioplayer.
+#
+# esp32-audioplayer is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32-audioplayer is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32-audioplayer. If not, see <http://www.gnu.org/licenses/>.
+#
+"""
+Analyze SPI transaction traces of the firmware (build with SPI_TRACE, serial
+command 'x'): bus utilization, idle gaps and the share of each device. The
+VS1053 data writes are replayed against a model of the decoder FIFO, which
+is drained at the given bit rate, to find underruns. With a second log the
+same numbers are shown side by side, e.g. for two builds playing the same
+file.
+
+usage: spitrace.py serial.log [other.log] [--kbps 128]
+"""
+import argparse
+import re
+import sys
+
+DEVICES = ["VS1053 SCI", "VS1053 SDI", "SD", "RFID"]
+SDI = 1
+LINE = re.compile(r"^SPI (\d+) (\d+) (\d+) ([RW]) (\d+)")
+BEGIN = re.compile(r"SPITRACE BEGIN")
+
+# VS1053 stream buffer and the free space it requests data at (DREQ high)
+FIFO_BYTES = 2048
+DREQ_FREE = 32
+
+
+def read_trace(path):
+    """Transactions of the last capture in the log, as (start, end, device, write, length)."""
+    trace = []
+    with open(path, errors="replace") as f:
+        for line in f:
+            if BEGIN.search(line):
+                trace = []
+                continue
+            m = LINE.match(line.strip())
+            if m:
+                start, duration, device = int(m.group(1)), int(m.group(2)), int(m.group(3))
+                trace.append((start, start + duration, device, m.group(4) == "W", int(m.group(5))))
+    # micros() wraps after 71 minutes, unwrap relative to the first transaction
+    if trace:
+        base = trace[0][0]
+        trace = [((s - base) % 2**32, (s - base) % 2**32 + (e - s), d, w, n) for s, e, d, w, n in trace]
+    trace.sort()
+    return trace
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+
+def analyze(trace, kbps):
+    window = trace[-1][1] - trace[0][0] if trace else 0
+    stats = {"window ms": window / 1000.0, "transactions": len(trace)}
+
+    # union of the busy intervals, transactions of both cores may overlap in time
+    busy = 0
+    gaps = []
+    end = None
+    for start, stop, _, _, _ in trace:
+        if end is None or start >= end:
+            if end is not None:
+                gaps.append(start - end)
+            busy += stop - start
+            end = stop
+        elif stop > end:
+            busy += stop - end
+            end = stop
+    stats["bus busy %"] = 100.0 * busy / window if window else 0
+    stats["gap p50 us"] = percentile(gaps, 50)
+    stats["gap p99 us"] = percentile(gaps, 99)
+    stats["gap max us"] = max(gaps) if gaps else 0
+    stats["gaps > 1 ms"] = sum(1 for g in gaps if g > 1000)
+
+    for device, name in enumerate(DEVICES):
+        items = [t for t in trace if t[2] == device]
+        time = sum(t[1] - t[0] for t in items)
+        stats[name + " count"] = len(items)
+        stats[name + " bytes"] = sum(t[4] for t in items)
+        stats[name + " share %"] = 100.0 * time / busy if busy else 0
+        stats[name + " max us"] = max((t[1] - t[0] for t in items), default=0)
+
+    stats.update(replay(trace, kbps))
+    return stats
+
+
+def replay(trace, kbps):
+    """
+    Feed the SDI writes into the FIFO model. The decoder starts with the first
+    write and consumes kbps continuously, an underrun is time with an empty FIFO
+    before the last write.
+    """
+    writes = [(t[1], t[4]) for t in trace if t[2] == SDI and t[3]]
+    if not writes or kbps <= 0:
+        return {}
+    rate = kbps * 1000 / 8.0 / 1e6   # bytes per us
+    fill = 0.0
+    now = writes[0][0]
+    lowest = FIFO_BYTES
+    underruns = 0
+    underrun_us = 0.0
+    for at, length in writes:
+        # the FIFO ran dry since the previous write
+        consumed = (at - now) * rate
+        if consumed > fill:
+            underrun_us += (consumed - fill) / rate
+            underruns += 1
+            fill = 0.0
+        else:
+            fill -= consumed
+        lowest = min(lowest, fill)
+        fill = min(FIFO_BYTES, fill + length)
+        now = at
+    return {
+        "FIFO lowest bytes": round(lowest),
+        "FIFO underruns": underruns,
+        "FIFO underrun ms": underrun_us / 1000.0,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split("\n")[0])
+    parser.add_argument("logs", nargs="+", help="one or two serial logs with SPI traces")
+    parser.add_argument("--kbps", type=float, default=128, help="bit rate of the played file")
+    args = parser.parse_args()
+    if len(args.logs) > 2:
+        sys.exit("at most two logs can be compared")
+
+    results = []
+    for path in args.logs:
+        trace = read_trace(path)
+        if not trace:
+            sys.exit("%s: no SPI trace found" % path)
+        results.append(analyze(trace, args.kbps))
+
+    keys = list(results[0].keys())
+    width = max(len(k) for k in keys)
+    print("%-*s %12s%s" % (width, "", args.logs[0][-12:], " %12s %10s" % (args.logs[1][-12:], "change") if len(results) > 1 else ""))
+    for key in keys:
+        values = [r.get(key, 0) for r in results]
+        line = "%-*s %12s" % (width, key, fmt(values[0]))
+        if len(values) > 1:
+            change = "%+.1f%%" % (100.0 * (values[1] - values[0]) / values[0]) if values[0] else ""
+            line += " %12s %10s" % (fmt(values[1]), change)
+        print(line)
+
+
+def fmt(value):
+    return "%.2f" % value if isinstance(value, float) else str(value)
+
+
+if __name__ == "__main__":
+    main()